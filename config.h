@@ -18,8 +18,8 @@
  * This is the list of default tracefiles in TRACEDIR that the driver
  * will use for testing. Modify this if you want to add or delete
  * traces from the driver's test suite. For example, if you don't want
- * your students to implement realloc, you can delete the last two
- * traces.
+ * your students to implement realloc, you can delete the last four
+ * traces, which traces/gen-realloc.py generates.
  */
 #define DEFAULT_TRACEFILES \
   "amptjp-bal.rep",\
@@ -30,7 +30,11 @@
   "random-bal.rep",\
   "random2-bal.rep",\
   "binary-bal.rep",\
-  "binary2-bal.rep"
+  "binary2-bal.rep",\
+  "realloc-bal.rep",\
+  "realloc2-bal.rep",\
+  "realloc-string-bal.rep",\
+  "realloc-vector-bal.rep"
 
 /*
  * This constant gives the estimated performance of the libc malloc
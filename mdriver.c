@@ -7,15 +7,22 @@
  * Copyright (c) 2002, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE
+#include "clock.h"
 #include "config.h"
 #include "fsecs.h"
 #include "memlib.h"
 #include "mm.h"
+#include "perfctr.h"
+#include "trace.h"
 #include <assert.h>
 #include <ctype.h>
 #include <errno.h>
 #include <float.h>
 #include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -37,36 +44,77 @@
 //Heap size is allowed to be 65536 for free, since this is paltry
 #define FREE_HEAP 65536
 
+/* Number of range records the range pool gets from malloc at a time */
+#define RANGE_CHUNK 1024
+
+/* Number of requests read at a time from a streamed trace (-s) */
+#define STREAM_WINDOW 65536
+
+/* Number of slots an empty id map starts with, a power of 2 */
+#define IDMAP_MIN 1024
+
+/* Home slot of request id in an id map */
+#define IDMAP_HASH(id, mask) (((unsigned)(id) * 2654435761u) & (mask))
+
+/* Blocks a thread of a cross-thread replay (-j with -x) can be handed before it frees them */
+#define REPLAY_RING 4096
+
+/* Latency histogram buckets: exact below 2 * LAT_SUB cycles, then LAT_SUB per power of 2 */
+#define LAT_SUB_SHIFT 5
+#define LAT_SUB (1 << LAT_SUB_SHIFT)
+#define LAT_BUCKETS ((65 - LAT_SUB_SHIFT) * LAT_SUB)
+#define LAT_OVHD_SAMPLES 1000 /* empty timings the counter overhead is the least of */
+
 /******************************
  * The key compound data types
  *****************************/
 
-/* Records the extent of each block's payload */
+/* Records the extent of each block's payload, as a node of an AVL tree keyed by lo */
 typedef struct range_t {
-    char *lo;             /* low payload address */
-    char *hi;             /* high payload address */
-    struct range_t *next; /* next list element */
+    char *lo;              /* low payload address */
+    char *hi;              /* high payload address */
+    struct range_t *left;  /* payloads below lo, or the next record in the range pool */
+    struct range_t *right; /* payloads above hi */
+    int height;            /* height of the subtree rooted here */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
+/* A live block of a streamed trace, kept in an id map under its request id */
 typedef struct {
-    enum { ALLOC,
-           FREE,
-           REALLOC } type; /* type of request */
-    int index;             /* index for free() to use later */
-    int size;              /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
+    int id;   /* request id, -1 for an empty slot */
+    int size; /* payload size */
+    char *p;  /* payload address */
+} idslot_t;
+
+/* Hash map from the request ids of a streamed trace to their live blocks, with linear probing */
 typedef struct {
-    int sugg_heapsize;   /* suggested heap size (unused) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-} trace_t;
+    idslot_t *slots; /* mask + 1 slots */
+    unsigned mask;   /* number of slots - 1, the number of slots being a power of 2 */
+    unsigned count;  /* number of live blocks */
+} idmap_t;
+
+/* Log bucketed histogram of the cycles calls took, precise to 1 / LAT_SUB of their value */
+typedef struct {
+    unsigned long count;                /* calls recorded */
+    unsigned long max;                  /* cycles of the slowest */
+    unsigned long buckets[LAT_BUCKETS]; /* calls in each bucket, see lat_bucket */
+} lat_hist_t;
+
+/*
+ * A thread of a parallel replay (-j), which replays its own copy of a trace.
+ * In a cross-thread replay it hands the blocks it is done with to the next
+ * thread instead of freeing them, through that thread's ring.
+ */
+typedef struct replay_t {
+    pthread_t tid;
+    trace_t *trace;
+    char **blocks;         /* payloads of this thread's copy of the trace */
+    struct replay_t *next; /* thread freeing the blocks in a cross-thread replay */
+    struct timespec start; /* when the thread started on its copy */
+    struct timespec end;   /* and when it was done, with the blocks handed to it */
+    unsigned head;         /* ring slots taken out by this thread */
+    unsigned tail;         /* ring slots filled by the previous thread */
+    char *ring[REPLAY_RING];
+} replay_t;
 
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
@@ -88,9 +136,30 @@ typedef struct {
 
     int ideal_max_heap;
     int max_heap;
+    long peak_rss; /* most bytes of the heap resident at once, 0 if unknown */
+    long heap_grows; /* times the heap grew */
+    int heap_counted;         /* did mm_stats count requests? (mm.c built with MM_STATS) */
+    mm_stats_t heap_at_peak;  /* mm_stats when the trace had the most payload, with -S */
+    mm_stats_t heap_at_end;   /* mm_stats at the end of the trace, with -S */
+    lat_hist_t *latency;      /* cycles per call of each request type (ALLOC, FREE, REALLOC), with -L */
+    double perf[PERF_EVENTS]; /* hardware events per request, -1 if not counted, with -P */
+    double par_secs1;         /* secs of a replay of the trace by one thread, with -j */
+    double par_secs;          /* secs of the parallel replay of -j, until its last thread was done */
+    double par_slowest;       /* secs the slowest of those threads took on its copy */
+    unsigned long par_waits;  /* arena lock waits during the parallel replay */
+    double *trial_secs;       /* secs of each trial, secs is their median */
+    double kops_mean;         /* mean throughput over the trials */
+    double kops_stddev;       /* its sample standard deviation */
+    double kops_ci95;         /* half the width of the 95% confidence interval of the mean */
 
     /* defined only for the student malloc package */
     double util; /* space utilization for this trace (always 0 for libc) */
+    double realloc_ops;    /* number of reallocs in the trace */
+    double realloc_moved;  /* reallocs that returned a new address */
+    double realloc_copied; /* payload bytes those reallocs had to copy */
+    double realloc_secs;   /* secs spent in mm_realloc alone, the median of the trials */
+    double *trial_realloc_secs; /* those secs in each trial */
+    double realloc_kops_ci95;   /* half the width of the 95% confidence interval of their mean throughput */
 
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
@@ -100,8 +169,28 @@ typedef struct {
  *******************/
 int verbose = 0;       /* global flag for verbose output */
 static int errors = 0; /* number of errs found when running student malloc */
+static int heap_stats = 0; /* print the mm_stats of each trace (set by -S) */
+static int latency = 0;    /* time every call of mm malloc (set by -L) */
+static int perf = 0;       /* count hardware events of mm malloc (set by -P) */
+static unsigned long counter_ovhd; /* cycles lat_start and lat_stop add to a timed call, with -L */
+static int jobs = 0;        /* threads of the parallel replay, 0 for none (set by -j) */
+static int cross = 0;       /* threads free the blocks of the previous thread (set by -x) */
+static pthread_barrier_t replay_start; /* lets the threads of a parallel replay start together */
+static int trials = NUM_TRIAL; /* timed runs of each trace (set by -n) */
+static int warmup = 0;      /* untimed runs of each trace before the first (set by -w) */
+static int batches = 0;     /* group runs of like requests into batches (set by -B) */
+static char *cpu = NULL;    /* cpu to run the driver on (set by -c) */
+static char *output = NULL; /* file to write the results to as JSON, or CSV if it ends in .csv (set by -o) */
+static int replays;         /* threads of the parallel replay running */
+static int replays_done;    /* threads of a cross-thread replay done with their copy */
 char msg[MAXLINE];     /* for whenever we need to compose an error message */
 
+/* The batch of requests being made by mm_malloc_bulk or mm_free_bulk */
+static traceop_t *batch_start, *batch_end; /* its requests */
+static void *batch_ptrs[TRACE_MAX_BATCH];  /* the payloads mm_malloc_bulk gave or mm_free_bulk is to free */
+static int batch_count;                    /* payloads in batch_ptrs */
+static int batch_next;                     /* next of them to hand out */
+
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -110,19 +199,42 @@ static char tracedir[MAXLINE] = TRACEDIR;
 static char *default_tracefiles[] = {
     DEFAULT_TRACEFILES, NULL};
 
+/* Unused range records, linked through their left pointer */
+static range_t *range_pool = NULL;
+
 /*********************
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate range trees */
 static int add_range(range_t **ranges, char *lo, int size,
                      int tracenum, int opnum);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
 
+/* These functions keep the range trees balanced and their records pooled */
+static range_t *new_range(void);
+static void free_range(range_t *p);
+static range_t *range_below(range_t *root, char *addr);
+static range_t *range_balance(range_t *p);
+static range_t *range_insert(range_t *root, range_t *p);
+static range_t *range_delete_min(range_t *root, range_t **min);
+static range_t *range_delete(range_t *root, char *lo);
+
 /* These functions read, allocate, and free storage for traces */
+static char *trace_path(char *path, char *tracedir, char *filename);
 static trace_t *read_trace(char *tracedir, char *filename);
-static void free_trace(trace_t *trace);
+static void mark_batches(trace_t *trace);
+
+/* these functions make the requests of a batch with one call of mm_malloc_bulk or mm_free_bulk */
+static void *batch_malloc(traceop_t *op);
+static void batch_free(traceop_t *op, void *p);
+
+/* these functions map the request ids of a streamed trace to their blocks */
+static void idmap_clear(idmap_t *map);
+static idslot_t *idmap_find(idmap_t *map, int id);
+static idslot_t *idmap_add(idmap_t *map, int id);
+static void idmap_remove(idmap_t *map, idslot_t *slot);
 
 /* Routines for evaluating the correctness and speed of libc malloc */
 static int eval_libc_valid(trace_t *trace, int tracenum);
@@ -131,12 +243,47 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int *ideal_m, int *m);
+static void eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats);
 static void eval_mm_speed(void *ptr);
+static void eval_mm_realloc(trace_t *trace, stats_t *stats);
+static void eval_mm_latency(trace_t *trace, stats_t *stats);
+static void eval_mm_perf(speed_t *speed_params, stats_t *stats);
+static void eval_mm_parallel(trace_t *trace, stats_t *stats);
+static double replay_parallel(trace_t *trace, int n, double *slowest, unsigned long *waits);
+static void *replay_thread(void *arg);
+static void replay_free(replay_t *r, char *p);
+static void replay_drain(replay_t *r);
+static inline unsigned long lat_start(void);
+static inline unsigned long lat_stop(void);
+static unsigned long lat_ovhd(void);
+static int lat_bucket(unsigned long cycles);
+static unsigned long lat_percentile(lat_hist_t *hist, double fraction);
+static int eval_mm_stream(char *tracedir, char *filename, int tracenum,
+                          stats_t *stats, range_t **ranges);
+static int stream_valid_op(traceop_t *op, int tracenum, int opnum,
+                           range_t **ranges, idmap_t *live, int *total_size);
+static void stream_speed_op(traceop_t *op, idmap_t *live);
+
+/* These functions measure how much of the heap is resident */
+static long rss_start(void);
+static long rss_peak(long base);
+static long proc_status_kb(char *field);
 
 /* Various helper routines */
 static void printresults(int n, stats_t *stats);
+static void printrealloc(int n, stats_t *stats);
+static void printheapstats(int n, stats_t *stats);
+static void printlatency(int n, stats_t *stats);
+static void printperf(int n, stats_t *stats);
+static void printparallel(int n, stats_t *stats);
+static void printtrials(int n, stats_t *stats);
+static void trial_summary(stats_t *stats);
+static double trial_spread(double *secs, double ops, double *mean, double *stddev, double *ci95);
+static int compare_secs(const void *a, const void *b);
+static void write_results(char *path, int n, stats_t *stats, double perfindex);
+static void pin_cpu(char *cpu);
 static void usage(void);
+static int set_placement(char *policy);
 static void unix_error(char *msg);
 static void malloc_error(int tracenum, int opnum, char *msg);
 static void app_error(char *msg);
@@ -160,6 +307,7 @@ int main(int argc, char **argv) {
     int team_check = 1; /* If set, check team structure (reset by -a) */
     int run_libc = 0;   /* If set, run libc malloc (set by -l) */
     int autograder = 0; /* If set, emit summary info for autograder (-g) */
+    int stream = 0;     /* If set, stream the traces instead of reading them (-s) */
 
     /* temporaries used to compute the performance index */
     double util, scaled_util, throughput, avg_mm_util, avg_mm_throughput, perfindex; 
@@ -169,7 +317,7 @@ int main(int argc, char **argv) {
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "f:t:hvVgal")) != EOF) {
+    while ((c = getopt(argc, argv, "c:f:H:j:n:o:t:p:w:hvVgaBlLPsSx")) != EOF) {
         switch (c) {
         case 'g': /* Generate summary info for the autograder */
             autograder = 1;
@@ -182,6 +330,32 @@ int main(int argc, char **argv) {
             tracefiles[0] = strdup(optarg);
             tracefiles[1] = NULL;
             break;
+        case 'c': /* Run on this cpu only */
+            cpu = optarg;
+            break;
+        case 'n': /* Time each trace this many times */
+            if ((trials = atoi(optarg)) < 1)
+                app_error("-n takes a number of trials");
+            break;
+        case 'w': /* Run each trace this many times before timing it */
+            if ((warmup = atoi(optarg)) < 0)
+                app_error("-w takes a number of runs");
+            break;
+        case 'o': /* Write the results to a file */
+            output = optarg;
+            break;
+        case 'H': /* Back the heap by huge pages */
+            if (!strcmp(optarg, "thp"))
+                mem_set_pages(MEM_PAGES_THP);
+            else if (!strcmp(optarg, "hugetlb"))
+                mem_set_pages(MEM_PAGES_HUGETLB);
+            else
+                app_error("-H takes thp or hugetlb");
+            break;
+        case 'j': /* Replay the traces on this many threads at once */
+            if ((jobs = atoi(optarg)) < 1)
+                app_error("-j takes a number of threads");
+            break;
         case 't':                    /* Directory where the traces are located */
             if (num_tracefiles == 1) /* ignore if -f already encountered */
                 break;
@@ -192,9 +366,31 @@ int main(int argc, char **argv) {
         case 'a': /* Don't check team structure */
             team_check = 0;
             break;
+        case 'B': /* Make runs of like requests with mm_malloc_bulk and mm_free_bulk */
+            batches = 1;
+            break;
         case 'l': /* Run libc malloc */
             run_libc = 1;
             break;
+        case 'L': /* Time every call of mm malloc */
+            latency = 1;
+            break;
+        case 'P': /* Count hardware events of mm malloc */
+            perf = 1;
+            break;
+        case 'p': /* Placement policy of mm malloc */
+            if (set_placement(optarg) < 0)
+                app_error("-p takes first, next, best, good or good:<k>");
+            break;
+        case 's': /* Stream the traces a window of requests at a time */
+            stream = 1;
+            break;
+        case 'S': /* Print the heap statistics of mm malloc */
+            heap_stats = 1;
+            break;
+        case 'x': /* Free blocks on another thread in the parallel replay */
+            cross = 1;
+            break;
         case 'v': /* Print per-trace performance breakdown */
             verbose = 1;
             break;
@@ -266,6 +462,27 @@ int main(int argc, char **argv) {
     /* Initialize the timing package */
     init_fsecs();
 
+    /* libc malloc is evaluated on traces held in memory */
+    if (stream && run_libc)
+        app_error("-l cannot be combined with -s");
+    if (stream && latency)
+        app_error("-L cannot be combined with -s");
+    if (latency)
+        counter_ovhd = lat_ovhd();
+    if (stream && perf)
+        app_error("-P cannot be combined with -s");
+    if (perf && perf_open() == 0)
+        app_error("-P found no hardware event counters, see perf_event_paranoid");
+    if (stream && jobs)
+        app_error("-j cannot be combined with -s");
+    if (jobs && !mm_thread_safe())
+        app_error("-j needs the thread safe mm malloc of mdriver-mt");
+    /* the replay threads would inherit the cpu of the driver */
+    if (cpu != NULL && jobs)
+        app_error("-c cannot be combined with -j");
+    if (cpu != NULL)
+        pin_cpu(cpu);
+
     /*
      * Optionally run and evaluate the libc malloc package
      */
@@ -314,54 +531,84 @@ int main(int argc, char **argv) {
     if (mm_stats == NULL)
         unix_error("mm_stats calloc in main failed");
 
-    int max_heap, ideal_max_heap;
     int trial_counter;
-    double prev_secs;
-    for (trial_counter = 0; trial_counter < NUM_TRIAL; trial_counter ++) {
+    /* a streamed trace may come from a pipe, which can be read only once */
+    if (stream)
+        trials = 1;
+    for (i = 0; i < num_tracefiles; i++)
+        if ((mm_stats[i].trial_secs = calloc(trials, sizeof(double))) == NULL ||
+            (mm_stats[i].trial_realloc_secs = calloc(trials, sizeof(double))) == NULL)
+            unix_error("mm_stats calloc in main failed");
+    for (trial_counter = 0; trial_counter < trials; trial_counter ++) {
 
         /* Initialize the simulated memory system in memlib.c */
         mem_init();
 
         for (i = 0; i < num_tracefiles; i++) {
-            if (trial_counter == 0) {
-                prev_secs = DBL_MAX;
-            } else {
-                prev_secs = mm_stats[i].secs;
+            if (stream) {
+                mm_stats[i].filename = tracefiles[i];
+                trace_weights[i] = eval_mm_stream(tracedir, tracefiles[i], i, &mm_stats[i], &ranges);
+                mm_stats[i].trial_secs[0] = mm_stats[i].secs;
+                continue;
             }
             trace = read_trace(tracedir, tracefiles[i]);
             trace_weights[i] = trace->weight;
             mm_stats[i].ops = trace->num_ops;
             mm_stats[i].filename = tracefiles[i];
-            if (verbose > 1)
-                printf("Checking mm_malloc for correctness, ");
-            mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
-            if (mm_stats[i].valid) {
+            /* correctness and utilization are the same in every trial */
+            if (trial_counter == 0) {
                 if (verbose > 1)
-                    printf("efficiency, ");
-                mm_stats[i].util = eval_mm_util(trace, i, &ranges, &ideal_max_heap, &max_heap);
-
-                mm_stats[i].max_heap = max_heap;
-                mm_stats[i].ideal_max_heap = ideal_max_heap;
+                    printf("Checking mm_malloc for correctness, ");
+                mm_stats[i].valid = eval_mm_valid(trace, i, &ranges);
+                if (mm_stats[i].valid) {
+                    if (verbose > 1)
+                        printf("efficiency, ");
+                    eval_mm_util(trace, i, &ranges, &mm_stats[i]);
+                }
+            }
+            if (mm_stats[i].valid) {
                 speed_params.trace = trace;
                 speed_params.ranges = ranges;
                 if (verbose > 1)
                     printf("and performance.\n");
-                // get best speed
-                mm_stats[i].secs = fsecs(eval_mm_speed, &speed_params);
-                if (mm_stats[i].secs > prev_secs) {
-                    mm_stats[i].secs = prev_secs;
-                }
+                /* warm the caches and the pages of the heap up for the first trial */
+                for (int w = 0; trial_counter == 0 && w < warmup; w++)
+                    eval_mm_speed(&speed_params);
+                mm_stats[i].trial_secs[trial_counter] = fsecs(eval_mm_speed, &speed_params);
+                eval_mm_realloc(trace, &mm_stats[i]);
+                mm_stats[i].trial_realloc_secs[trial_counter] = mm_stats[i].realloc_secs;
+                if (trial_counter == 0 && latency)
+                    eval_mm_latency(trace, &mm_stats[i]);
+                if (trial_counter == 0 && perf)
+                    eval_mm_perf(&speed_params, &mm_stats[i]);
+                if (trial_counter == 0 && jobs)
+                    eval_mm_parallel(trace, &mm_stats[i]);
             }
             free_trace(trace);
         }
     }
+    /* a trace and its reallocs run as fast as the median of their trials */
+    for (i = 0; i < num_tracefiles; i++)
+        if (mm_stats[i].valid)
+            trial_summary(&mm_stats[i]);
 
     /* Display the mm results in a compact table */
     if (verbose) {
         fprintf(result_fstream,"\nResults for mm malloc:\n");
         printresults(num_tracefiles, mm_stats);
         fprintf(result_fstream,"\n");
+        printrealloc(num_tracefiles, mm_stats);
     }
+    if (latency)
+        printlatency(num_tracefiles, mm_stats);
+    if (perf)
+        printperf(num_tracefiles, mm_stats);
+    if (jobs)
+        printparallel(num_tracefiles, mm_stats);
+    if (trials > 1)
+        printtrials(num_tracefiles, mm_stats);
+    if (heap_stats)
+        printheapstats(num_tracefiles, mm_stats);
 
     /*
      * Accumulate the aggregate statistics for the student's mm package
@@ -398,6 +645,9 @@ int main(int argc, char **argv) {
         printf("Terminated with %d errors\n", errors);
     }
 
+    if (output != NULL)
+        write_results(output, num_tracefiles, mm_stats, perfindex);
+
     if (autograder) {
         fprintf(result_fstream,"correct:%d\n", numcorrect);
         fprintf(result_fstream,"perfidx:%.0f\n", perfindex);
@@ -409,11 +659,160 @@ int main(int argc, char **argv) {
 }
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks. It is an
+ * AVL tree ordered by the low payload address, so every operation
+ * takes O(log n) in the number of allocated blocks.
  ****************************************************************/
 
+/*
+ * new_range - Take a range record from the pool, refilling the pool
+ *     with RANGE_CHUNK records when it is empty
+ */
+static range_t *new_range(void) {
+    range_t *p;
+    int i;
+
+    if (range_pool == NULL) {
+        if ((p = (range_t *)malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+            unix_error("malloc error in new_range");
+        for (i = 0; i < RANGE_CHUNK; i++)
+            free_range(&p[i]);
+    }
+    p = range_pool;
+    range_pool = p->left;
+    return p;
+}
+
+/*
+ * free_range - Give a range record back to the pool
+ */
+static void free_range(range_t *p) {
+    p->left = range_pool;
+    range_pool = p;
+}
+
+/*
+ * range_below - Return the range with the highest lo not above addr, or NULL
+ *     Since the ranges in a tree never overlap, this is the only range
+ *     that can contain addr or overlap a payload ending at addr.
+ */
+static range_t *range_below(range_t *root, char *addr) {
+    range_t *best = NULL;
+
+    while (root != NULL) {
+        if (root->lo <= addr) {
+            best = root;
+            root = root->right;
+        } else {
+            root = root->left;
+        }
+    }
+    return best;
+}
+
+#define RANGE_HEIGHT(p) ((p) == NULL ? 0 : (p)->height)
+
+/*
+ * range_balance - Fix the height of p after one of its subtrees changed
+ *     by at most one level, rotating when the subtrees differ by two.
+ *     Returns the new root of the subtree.
+ */
+static range_t *range_balance(range_t *p) {
+    int diff = RANGE_HEIGHT(p->left) - RANGE_HEIGHT(p->right);
+    range_t *q;
+
+    if (diff > 1) {
+        q = p->left;
+        if (RANGE_HEIGHT(q->left) < RANGE_HEIGHT(q->right)) {
+            /* left-right case: rotate the left child left first */
+            p->left = q->right;
+            q->right = p->left->left;
+            p->left->left = range_balance(q);
+            q = p->left;
+        }
+        /* rotate p right */
+        p->left = q->right;
+        q->right = range_balance(p);
+        p = q;
+    } else if (diff < -1) {
+        q = p->right;
+        if (RANGE_HEIGHT(q->right) < RANGE_HEIGHT(q->left)) {
+            /* right-left case: rotate the right child right first */
+            p->right = q->left;
+            q->left = p->right->right;
+            p->right->right = range_balance(q);
+            q = p->right;
+        }
+        /* rotate p left */
+        p->right = q->left;
+        q->left = range_balance(p);
+        p = q;
+    }
+    p->height = 1 + (RANGE_HEIGHT(p->left) > RANGE_HEIGHT(p->right) ?
+                     RANGE_HEIGHT(p->left) : RANGE_HEIGHT(p->right));
+    return p;
+}
+
+/*
+ * range_insert - Insert range p into the tree, returns the new root
+ */
+static range_t *range_insert(range_t *root, range_t *p) {
+    if (root == NULL) {
+        p->left = p->right = NULL;
+        p->height = 1;
+        return p;
+    }
+    if (p->lo < root->lo)
+        root->left = range_insert(root->left, p);
+    else
+        root->right = range_insert(root->right, p);
+    return range_balance(root);
+}
+
+/*
+ * range_delete_min - Unlink the lowest range of the tree into *min, returns the new root
+ */
+static range_t *range_delete_min(range_t *root, range_t **min) {
+    if (root->left == NULL) {
+        *min = root;
+        return root->right;
+    }
+    root->left = range_delete_min(root->left, min);
+    return range_balance(root);
+}
+
+/*
+ * range_delete - Unlink the range starting at lo from the tree and give
+ *     it back to the pool, returns the new root
+ */
+static range_t *range_delete(range_t *root, char *lo) {
+    range_t *p;
+
+    if (root == NULL)
+        return NULL;
+    if (lo < root->lo) {
+        root->left = range_delete(root->left, lo);
+    } else if (lo > root->lo) {
+        root->right = range_delete(root->right, lo);
+    } else {
+        p = root;
+        if (p->right == NULL) {
+            root = p->left;
+        } else {
+            /* replace p by the lowest range of its right subtree */
+            p->right = range_delete_min(p->right, &root);
+            root->left = p->left;
+            root->right = p->right;
+        }
+        free_range(p);
+        if (root == NULL)
+            return NULL;
+    }
+    return range_balance(root);
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
@@ -436,36 +835,36 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* The payload must lie within the extent of the heap */
-    if ((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
-        (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) {
+    /* The payload must lie within the extent of the heap, or a region mem_map gave the package */
+    if (((lo < (char *)mem_heap_lo()) || (lo > (char *)mem_heap_hi()) ||
+         (hi < (char *)mem_heap_lo()) || (hi > (char *)mem_heap_hi())) &&
+        !mem_is_mapped(lo, hi)) {
         sprintf(msg, "Payload (%p:%p) lies outside heap (%p:%p)",
                 lo, hi, mem_heap_lo(), mem_heap_hi());
         malloc_error(tracenum, opnum, msg);
         return 0;
     }
 
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges; p != NULL; p = p->next) {
-        if ((lo >= p->lo && lo <= p->hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                    lo, hi, p->lo, p->hi);
-            malloc_error(tracenum, opnum, msg);
-            return 0;
-        }
+    /*
+     * The payload must not overlap any other payloads. Only the
+     * payload starting last at or before hi can reach into it.
+     */
+    p = range_below(*ranges, hi);
+    if (p != NULL && p->hi >= lo) {
+        sprintf(msg, "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                lo, hi, p->lo, p->hi);
+        malloc_error(tracenum, opnum, msg);
+        return 0;
     }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by taking a range struct from the pool and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
-    *ranges = p;
+    *ranges = range_insert(*ranges, p);
     return 1;
 }
 
@@ -473,32 +872,20 @@ static int add_range(range_t **ranges, char *lo, int size,
  * remove_range - Free the range record of block whose payload starts at lo
  */
 static void remove_range(range_t **ranges, char *lo) {
-    range_t *p;
-    range_t **prevpp = ranges;
-    //int size;
-
-    for (p = *ranges; p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            //size = p->hi - p->lo + 1;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
-    }
+    *ranges = range_delete(*ranges, lo);
 }
 
 /*
- * clear_ranges - free all of the range records for a trace
+ * clear_ranges - give all of the range records for a trace back to the pool
  */
 static void clear_ranges(range_t **ranges) {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges; p != NULL; p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free_range(p);
     *ranges = NULL;
 }
 
@@ -507,98 +894,173 @@ static void clear_ranges(range_t **ranges) {
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * trace_path - Put the path of trace file filename in tracedir into path
+ *     A filename of "-" stands for the standard input wherever it is.
+ */
+static char *trace_path(char *path, char *tracedir, char *filename) {
+    if (strcmp(filename, "-") == 0) {
+        strcpy(path, filename);
+    } else {
+        strcpy(path, tracedir);
+        strcat(path, filename);
+    }
+    return path;
+}
+
+/*
+ * read_trace - read a trace file in tracedir and store it in memory
  */
 static trace_t *read_trace(char *tracedir, char *filename) {
-    FILE *tracefile;
-    trace_t *trace;
-    char type[MAXLINE];
     char path[500];
-    unsigned index, size;
-    unsigned max_index = 0;
-    unsigned op_index;
+
+    trace_t *trace;
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
+    trace = load_trace(trace_path(path, tracedir, filename));
+    /* the requests of the new trace may lie where those of a batch of the last one did */
+    batch_start = batch_end = NULL;
+    if (batches)
+        mark_batches(trace);
+    return trace;
+}
+
+/*
+ * mark_batches - Group each run of allocations of one size, and each run of
+ *     frees, into a batch. Requests already in a batch stay in it.
+ */
+static void mark_batches(trace_t *trace) {
+    traceop_t *ops = trace->ops;
+    int i, j;
 
-    /* Allocate the trace record */
-    if ((trace = (trace_t *)malloc(sizeof(trace_t))) == NULL)
-        unix_error("malloc 1 failed in read_trance");
+    for (i = 0; i < trace->num_ops; i = j) {
+        if (ops[i].batch > 1) {
+            j = i + ops[i].batch;
+            continue;
+        }
+        for (j = i + 1; j < trace->num_ops && j - i < TRACE_MAX_BATCH; j++) {
+            if (ops[i].type == REALLOC || ops[j].type != ops[i].type || ops[j].batch > 1 ||
+                (ops[i].type == ALLOC && ops[j].size != ops[i].size))
+                break;
+        }
+        if (j - i > 1)
+            ops[i].batch = j - i;
+    }
+}
 
-    /* Read the trace file header */
-    strcpy(path, tracedir);
-    strcat(path, filename);
-    if ((tracefile = fopen(path, "r")) == NULL) {
-        sprintf(msg, "Could not open %s in read_trace", path);
-        unix_error(msg);
+/*
+ * batch_malloc - Make the allocation request op
+ *     The first request of a batch allocates the payloads of all of its
+ *     requests with mm_malloc_bulk, which are then handed out in order.
+ *     Returns NULL when there is no payload for op.
+ */
+static void *batch_malloc(traceop_t *op) {
+    if (op->batch > 1) {
+        batch_start = op;
+        batch_end = op + op->batch;
+        batch_count = mm_malloc_bulk(op->size, op->batch, batch_ptrs);
+        batch_next = 0;
     }
-    fscanf(tracefile, "%d", &(trace->sugg_heapsize)); /* not used */
-    fscanf(tracefile, "%d", &(trace->num_ids));
-    fscanf(tracefile, "%d", &(trace->num_ops));
-    fscanf(tracefile, "%d", &(trace->weight)); /* not used */
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-             (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
-
-    /* We'll keep an array of pointers to the allocated blocks here... */
-    if ((trace->blocks =
-             (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
-        unix_error("malloc 3 failed in read_trace");
-
-    /* ... along with the corresponding byte sizes of each block */
-    if ((trace->block_sizes =
-             (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
-        unix_error("malloc 4 failed in read_trace");
-
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch (type[0]) {
-        case 'a':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            fscanf(tracefile, "%u %u", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            fscanf(tracefile, "%ud", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            printf("Bogus type character (%c) in tracefile %s\n",
-                   type[0], path);
-            exit(1);
-        }
-        op_index++;
+    if (op < batch_start || op >= batch_end)
+        return mm_malloc(op->size);
+    return (batch_next < batch_count) ? batch_ptrs[batch_next++] : NULL;
+}
+
+/*
+ * batch_free - Make the free request op of payload p
+ *     The payloads of a batch are collected and freed together with
+ *     mm_free_bulk by its last request.
+ */
+static void batch_free(traceop_t *op, void *p) {
+    if (op->batch > 1) {
+        batch_start = op;
+        batch_end = op + op->batch;
+        batch_count = 0;
+    }
+    if (op < batch_start || op >= batch_end) {
+        mm_free(p);
+        return;
     }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
+    batch_ptrs[batch_count++] = p;
+    if (op + 1 == batch_end)
+        mm_free_bulk(batch_ptrs, batch_count);
+}
 
-    return trace;
+/*****************************************************************
+ * The following routines manipulate id maps, which map the request
+ * ids of a streamed trace to their live blocks. Their size follows
+ * the number of live blocks instead of the number of ids in the
+ * trace. Slots are found by linear probing, and a removal shifts
+ * the slots after it back so that no probe sequence is broken.
+ ****************************************************************/
+
+/*
+ * idmap_clear - Empty an id map, shrinking it back to IDMAP_MIN slots
+ */
+static void idmap_clear(idmap_t *map) {
+    free(map->slots);
+    if ((map->slots = (idslot_t *)malloc(IDMAP_MIN * sizeof(idslot_t))) == NULL)
+        unix_error("malloc error in idmap_clear");
+    memset(map->slots, -1, IDMAP_MIN * sizeof(idslot_t));
+    map->mask = IDMAP_MIN - 1;
+    map->count = 0;
 }
 
 /*
- * free_trace - Free the trace record and the three arrays it points
- *              to, all of which were allocated in read_trace().
+ * idmap_find - Return the slot of the live block with request id, or NULL
  */
-void free_trace(trace_t *trace) {
-    free(trace->ops); /* free the three arrays... */
-    free(trace->blocks);
-    free(trace->block_sizes);
-    free(trace); /* and the trace record itself... */
+static idslot_t *idmap_find(idmap_t *map, int id) {
+    unsigned i;
+
+    for (i = IDMAP_HASH(id, map->mask); map->slots[i].id >= 0; i = (i + 1) & map->mask)
+        if (map->slots[i].id == id)
+            return &map->slots[i];
+    return NULL;
+}
+
+/*
+ * idmap_add - Return a new slot for request id, which must not be live,
+ *     doubling the map first when it would be more than 3/4 full
+ */
+static idslot_t *idmap_add(idmap_t *map, int id) {
+    idslot_t *old = map->slots;
+    unsigned i, n = map->mask + 1;
+
+    if ((map->count + 1) * 4 > n * 3) {
+        if ((map->slots = (idslot_t *)malloc(2 * n * sizeof(idslot_t))) == NULL)
+            unix_error("malloc error in idmap_add");
+        memset(map->slots, -1, 2 * n * sizeof(idslot_t));
+        map->mask = 2 * n - 1;
+        map->count = 0;
+        for (i = 0; i < n; i++)
+            if (old[i].id >= 0)
+                *idmap_add(map, old[i].id) = old[i];
+        free(old);
+    }
+    for (i = IDMAP_HASH(id, map->mask); map->slots[i].id >= 0; i = (i + 1) & map->mask)
+        ;
+    map->slots[i].id = id;
+    map->count++;
+    return &map->slots[i];
+}
+
+/*
+ * idmap_remove - Remove the block in slot from the map
+ */
+static void idmap_remove(idmap_t *map, idslot_t *slot) {
+    unsigned hole = slot - map->slots;
+    unsigned i, home;
+
+    for (i = (hole + 1) & map->mask; map->slots[i].id >= 0; i = (i + 1) & map->mask) {
+        /* the slot at i may fill the hole unless its home lies after the hole, up to i */
+        home = IDMAP_HASH(map->slots[i].id, map->mask);
+        if (((i - home) & map->mask) >= ((i - hole) & map->mask)) {
+            map->slots[hole] = map->slots[i];
+            hole = i;
+        }
+    }
+    map->slots[hole].id = -1;
+    map->count--;
 }
 
 /**********************************************************************
@@ -638,7 +1100,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
         case ALLOC: /* mm_malloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = batch_malloc(&trace->ops[i])) == NULL) {
                 malloc_error(tracenum, i, "mm_malloc failed.");
                 return 0;
             }
@@ -688,7 +1150,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
             if (size < oldsize)
                 oldsize = size;
             for (j = 0; j < oldsize; j++) {
-                if (newp[j] != (index & 0xFF)) {
+                if ((unsigned char)newp[j] != (index & 0xFF)) {
                     malloc_error(tracenum, i, "mm_realloc did not preserve the "
                                               "data from old block");
                     return 0;
@@ -706,7 +1168,7 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
             /* Remove region from list and call student's free function */
             p = trace->blocks[index];
             remove_range(ranges, p);
-            mm_free(p);
+            batch_free(&trace->ops[i], p);
             break;
 
         default:
@@ -723,29 +1185,33 @@ static int eval_mm_valid(trace_t *trace, int tracenum, range_t **ranges) {
  *   The idea is to remember the high water mark "hwm" of the heap for
  *   an optimal allocator, i.e., no gaps and no internal fragmentation.
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
- *   size of the heap in bytes after running the student's malloc
- *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   largest size of the heap in bytes while running the student's
+ *   malloc package on the trace. The package may lower the brk
+ *   pointer with mem_trim, so that is the high water mark of brk
+ *   kept by memlib.c rather than the final heap size. The peak
+ *   resident size of the heap and the number of times it grew are
+ *   measured along the way. The results go to stats.
  *
  */
-static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int *ideal_max_heap, int *max_heap) {
+static void eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, stats_t *stats) {
     int i;
     int index;
     int size, newsize, oldsize;
     int max_total_size = FREE_HEAP;
     int total_size = 0;
+    int peak_size = 0; /* most payload at once, without the floor of FREE_HEAP */
     char *p;
     char *newp, *oldp;
+    long rss_base;
 
     /* initialize the heap and the mm malloc package */
+    rss_base = rss_start();
     mem_reset_brk();
     if (mm_init() < 0)
         app_error("mm_init failed in eval_mm_util");
 
     for (i = 0; i < trace->num_ops; i++) {
         void *old_lo = mem_heap_lo();
-        void *old_hi = mem_heap_hi();
 
         switch (trace->ops[i].type) {
 
@@ -753,7 +1219,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int *
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = batch_malloc(&trace->ops[i])) == NULL)
                 app_error("mm_malloc failed in eval_mm_util");
 
             /* Remember region and size */
@@ -794,7 +1260,7 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int *
             size = trace->block_sizes[index];
             p = trace->blocks[index];
 
-            mm_free(p);
+            batch_free(&trace->ops[i], p);
 
             /* Keep track of current total size
 	     * of all allocated blocks */
@@ -805,21 +1271,32 @@ static double eval_mm_util(trace_t *trace, int tracenum, range_t **ranges, int *
         default:
             app_error("Nonexistent request type in eval_mm_util");
         }
-        if (old_lo != mem_heap_lo() || old_hi > mem_heap_hi())
-            app_error("Error, tampering with mem_heap_lo/hi");
+        /* the top of the heap may come down through mem_trim, never its bottom */
+        if (old_lo != mem_heap_lo())
+            app_error("Error, tampering with mem_heap_lo");
+        if (heap_stats && total_size > peak_size) {
+            peak_size = total_size;
+            mm_stats(&stats->heap_at_peak);
+        }
     }
-
-    *max_heap = mem_heapsize() > FREE_HEAP ? mem_heapsize() : FREE_HEAP;
-    *ideal_max_heap = max_total_size;
-    return ((double)*ideal_max_heap / (double)*max_heap);
+    if (heap_stats)
+        stats->heap_counted = mm_stats(&stats->heap_at_end) == 0;
+
+    stats->max_heap = mem_peak_heapsize() > FREE_HEAP ? mem_peak_heapsize() : FREE_HEAP;
+    stats->ideal_max_heap = max_total_size;
+    stats->util = (double)stats->ideal_max_heap / (double)stats->max_heap;
+    stats->peak_rss = rss_peak(rss_base);
+    stats->heap_grows = mem_grow_count();
 }
 
 /*
  * eval_mm_speed - This is the function that is used by fcyc()
  *    to measure the running time of the mm malloc package.
+ *    Batches of requests are made with mm_malloc_bulk and mm_free_bulk,
+ *    here and in eval_mm_valid and eval_mm_util.
  */
 static void eval_mm_speed(void *ptr) {
-    int i, index, size, newsize;
+    int i, index, newsize;
     char *p, *newp, *oldp, *block;
     trace_t *trace = ((speed_t *)ptr)->trace;
 
@@ -834,8 +1311,7 @@ static void eval_mm_speed(void *ptr) {
 
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
-            size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = batch_malloc(&trace->ops[i])) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -852,7 +1328,7 @@ static void eval_mm_speed(void *ptr) {
         case FREE: /* mm_free */
             index = trace->ops[i].index;
             block = trace->blocks[index];
-            mm_free(block);
+            batch_free(&trace->ops[i], block);
             break;
 
         default:
@@ -860,6 +1336,583 @@ static void eval_mm_speed(void *ptr) {
         }
 }
 
+/*
+ * eval_mm_perf - Count the hardware events of one timed replay of the trace
+ The counts, per request of the trace, include mm_init and the driver's own
+ bookkeeping around each call, the same work the speed is measured over.
+ */
+static void eval_mm_perf(speed_t *speed_params, stats_t *stats) {
+    int i;
+
+    perf_start();
+    eval_mm_speed(speed_params);
+    perf_stop(stats->perf);
+    for (i = 0; i < PERF_EVENTS; i++)
+        if (stats->perf[i] >= 0)
+            stats->perf[i] /= speed_params->trace->num_ops;
+}
+
+/*
+ * eval_mm_realloc - Measure the reallocs of a trace on their own
+ *    Replays the trace on a fresh heap and times every mm_realloc
+ *    call. A realloc that returns a new address had to copy the
+ *    smaller of the old and new payload, which is counted as the
+ *    bytes copied. Traces without reallocs are skipped.
+ */
+static void eval_mm_realloc(trace_t *trace, stats_t *stats) {
+    int i, index, size, oldsize;
+    char *p, *newp, *oldp;
+    struct timespec start, end;
+
+    stats->realloc_ops = 0;
+    stats->realloc_moved = 0;
+    stats->realloc_copied = 0;
+    stats->realloc_secs = 0;
+    for (i = 0; i < trace->num_ops; i++)
+        if (trace->ops[i].type == REALLOC)
+            break;
+    if (i == trace->num_ops)
+        return;
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_realloc");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(size)) == NULL)
+                app_error("mm_malloc error in eval_mm_realloc");
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            oldp = trace->blocks[index];
+            oldsize = trace->block_sizes[index];
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            newp = mm_realloc(oldp, size);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            if (newp == NULL)
+                app_error("mm_realloc error in eval_mm_realloc");
+            stats->realloc_secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+            stats->realloc_ops++;
+            if (newp != oldp) {
+                stats->realloc_moved++;
+                stats->realloc_copied += (size < oldsize) ? size : oldsize;
+            }
+            trace->blocks[index] = newp;
+            trace->block_sizes[index] = size;
+            break;
+
+        case FREE: /* mm_free */
+            mm_free(trace->blocks[index]);
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_realloc");
+        }
+    }
+}
+
+/*
+ * eval_mm_latency - Time each call of mm malloc on the trace with the cycle counter
+ The cycles of every call, counter overhead included, go into the latency histogram of
+ its request type; printlatency takes counter_ovhd off the percentiles. The trace is
+ replayed on a fresh heap of its own, so the timed runs of the trace are not slowed down.
+ */
+static void eval_mm_latency(trace_t *trace, stats_t *stats) {
+    int i, index, size;
+    char *p = NULL;
+    unsigned long start, cycles;
+    lat_hist_t *hist;
+
+    if (stats->latency == NULL && (stats->latency = malloc(3 * sizeof(lat_hist_t))) == NULL)
+        unix_error("malloc error in eval_mm_latency");
+    memset(stats->latency, 0, 3 * sizeof(lat_hist_t));
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in eval_mm_latency");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            start = lat_start();
+            p = mm_malloc(size);
+            cycles = lat_stop() - start;
+            if (p == NULL)
+                app_error("mm_malloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            start = lat_start();
+            p = mm_realloc(trace->blocks[index], size);
+            cycles = lat_stop() - start;
+            if (p == NULL)
+                app_error("mm_realloc error in eval_mm_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            start = lat_start();
+            mm_free(trace->blocks[index]);
+            cycles = lat_stop() - start;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_mm_latency");
+        }
+        hist = &stats->latency[trace->ops[i].type];
+        hist->buckets[lat_bucket(cycles)]++;
+        hist->count++;
+        if (cycles > hist->max)
+            hist->max = cycles;
+    }
+}
+
+/*
+ * eval_mm_parallel - Replay the trace on one thread, then on jobs threads at once
+ Every thread replays its own copy of the trace. The replay by one thread through the
+ same code gives the throughput the parallel one is measured against.
+ */
+static void eval_mm_parallel(trace_t *trace, stats_t *stats) {
+    double slowest;
+    unsigned long waits;
+
+    stats->par_secs1 = replay_parallel(trace, 1, &slowest, &waits);
+    stats->par_secs = replay_parallel(trace, jobs, &stats->par_slowest, &stats->par_waits);
+}
+
+/*
+ * replay_parallel - Replay a copy of the trace on each of n threads on a fresh heap
+ Returns the secs from the start of the first thread until the last one was done, sets
+ slowest to the secs the slowest thread took and waits to the arena lock waits the
+ replay caused.
+ */
+static double replay_parallel(trace_t *trace, int n, double *slowest, unsigned long *waits) {
+    replay_t *threads;
+    struct timespec *start, *end;
+    mm_stats_t heap;
+    double secs;
+    int i;
+
+    if ((threads = calloc(n, sizeof(replay_t))) == NULL)
+        unix_error("calloc error in replay_parallel");
+    for (i = 0; i < n; i++) {
+        threads[i].trace = trace;
+        threads[i].next = &threads[(i + 1) % n];
+        if ((threads[i].blocks = calloc(trace->num_ids, sizeof(char *))) == NULL)
+            unix_error("calloc error in replay_parallel");
+    }
+
+    /* Reset the heap and initialize the mm package */
+    mem_reset_brk();
+    if (mm_init() < 0)
+        app_error("mm_init failed in replay_parallel");
+    replays = n;
+    replays_done = 0;
+    pthread_barrier_init(&replay_start, NULL, n + 1);
+    for (i = 0; i < n; i++)
+        if (pthread_create(&threads[i].tid, NULL, replay_thread, &threads[i]) != 0)
+            unix_error("pthread_create error in replay_parallel");
+    pthread_barrier_wait(&replay_start);
+    for (i = 0; i < n; i++)
+        pthread_join(threads[i].tid, NULL);
+    pthread_barrier_destroy(&replay_start);
+
+    mm_stats(&heap);
+    *waits = heap.lock_waits;
+    *slowest = 0;
+    start = &threads[0].start;
+    end = &threads[0].end;
+    for (i = 0; i < n; i++) {
+        secs = (threads[i].end.tv_sec - threads[i].start.tv_sec) + (threads[i].end.tv_nsec - threads[i].start.tv_nsec) / 1e9;
+        if (secs > *slowest)
+            *slowest = secs;
+        if (threads[i].start.tv_sec < start->tv_sec ||
+            (threads[i].start.tv_sec == start->tv_sec && threads[i].start.tv_nsec < start->tv_nsec))
+            start = &threads[i].start;
+        if (threads[i].end.tv_sec > end->tv_sec ||
+            (threads[i].end.tv_sec == end->tv_sec && threads[i].end.tv_nsec > end->tv_nsec))
+            end = &threads[i].end;
+    }
+    secs = (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) / 1e9;
+    for (i = 0; i < n; i++)
+        free(threads[i].blocks);
+    free(threads);
+    return secs;
+}
+
+/*
+ * replay_thread - Replay a copy of the trace as one thread of a parallel replay
+ In a cross-thread replay the thread frees the blocks handed to it as it goes, and
+ once it is done with its copy, until every thread is.
+ */
+static void *replay_thread(void *arg) {
+    replay_t *r = arg;
+    trace_t *trace = r->trace;
+    int i, index;
+    char *p;
+
+    pthread_barrier_wait(&replay_start);
+    clock_gettime(CLOCK_MONOTONIC, &r->start);
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
+
+        case ALLOC: /* mm_malloc */
+            if ((p = mm_malloc(trace->ops[i].size)) == NULL)
+                app_error("mm_malloc error in replay_thread");
+            r->blocks[index] = p;
+            break;
+
+        case REALLOC: /* mm_realloc */
+            if ((p = mm_realloc(r->blocks[index], trace->ops[i].size)) == NULL)
+                app_error("mm_realloc error in replay_thread");
+            r->blocks[index] = p;
+            break;
+
+        case FREE: /* mm_free */
+            replay_free(r, r->blocks[index]);
+            break;
+
+        default:
+            app_error("Nonexistent request type in replay_thread");
+        }
+        if (cross)
+            replay_drain(r);
+    }
+    if (cross) {
+        __atomic_fetch_add(&replays_done, 1, __ATOMIC_RELEASE);
+        while (__atomic_load_n(&replays_done, __ATOMIC_ACQUIRE) < replays) {
+            replay_drain(r);
+            sched_yield();
+        }
+        replay_drain(r);
+    }
+    clock_gettime(CLOCK_MONOTONIC, &r->end);
+    return NULL;
+}
+
+/*
+ * replay_free - Free a block the thread is done with
+ In a cross-thread replay the block goes to the ring of the next thread, unless the
+ ring is full, in which case the thread frees it itself.
+ */
+static void replay_free(replay_t *r, char *p) {
+    replay_t *next = r->next;
+
+    if (cross) {
+        unsigned tail = next->tail;
+        if (tail - __atomic_load_n(&next->head, __ATOMIC_ACQUIRE) < REPLAY_RING) {
+            next->ring[tail % REPLAY_RING] = p;
+            __atomic_store_n(&next->tail, tail + 1, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+    mm_free(p);
+}
+
+/*
+ * replay_drain - Free the blocks the previous thread handed to this one
+ */
+static void replay_drain(replay_t *r) {
+    unsigned tail = __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE);
+    unsigned head = r->head;
+
+    for (; head != tail; head++)
+        mm_free(r->ring[head % REPLAY_RING]);
+    __atomic_store_n(&r->head, head, __ATOMIC_RELEASE);
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/*
+ * lat_start - Read the cycle counter before a timed call
+ The lfence after rdtsc keeps the call from starting before the counter is read.
+ */
+static inline unsigned long lat_start(void) {
+    unsigned hi, lo;
+    asm volatile("lfence; rdtsc; lfence" : "=a"(lo), "=d"(hi) : : "memory");
+    return ((unsigned long)hi << 32) | lo;
+}
+
+/*
+ * lat_stop - Read the cycle counter after a timed call
+ rdtscp waits for the call to finish, the lfence keeps what follows from starting first.
+ */
+static inline unsigned long lat_stop(void) {
+    unsigned hi, lo;
+    asm volatile("rdtscp; lfence" : "=a"(lo), "=d"(hi) : : "ecx", "memory");
+    return ((unsigned long)hi << 32) | lo;
+}
+#else
+static inline unsigned long lat_start(void) {
+    start_counter();
+    return 0;
+}
+
+static inline unsigned long lat_stop(void) {
+    return get_counter();
+}
+#endif
+
+/*
+ * lat_ovhd - Cycles lat_start and lat_stop take around an empty call
+ The least of LAT_OVHD_SAMPLES timings, since a single one may be slowed by a miss or an
+ interrupt and then make fast calls read 0.
+ */
+static unsigned long lat_ovhd(void) {
+    unsigned long least = ~0UL;
+    for (int i = 0; i < LAT_OVHD_SAMPLES; i++) {
+        unsigned long start = lat_start();
+        unsigned long cycles = lat_stop() - start;
+        if (cycles < least)
+            least = cycles;
+    }
+    return least;
+}
+
+/*
+ * lat_bucket - Bucket of a latency histogram counting a call of the given cycles
+ Below 2 * LAT_SUB each number of cycles has a bucket. Above, the cycles are cut to their
+ top LAT_SUB_SHIFT + 1 bits and bucket shift * LAT_SUB + (cycles >> shift) counts them,
+ where shift is the number of bits cut.
+ */
+static int lat_bucket(unsigned long cycles) {
+    if (cycles < 2 * LAT_SUB)
+        return cycles;
+    int shift = 63 - __builtin_clzl(cycles) - LAT_SUB_SHIFT;
+    return (shift << LAT_SUB_SHIFT) + (cycles >> shift);
+}
+
+/*
+ * lat_percentile - Cycles within which the given fraction of the calls of a histogram ran
+ The answer is the top of the bucket holding that call, so it errs on the slow side.
+ */
+static unsigned long lat_percentile(lat_hist_t *hist, double fraction) {
+    unsigned long rank = (unsigned long)(fraction * hist->count + 0.999999);
+    unsigned long seen = 0;
+    int i;
+
+    if (rank == 0)
+        rank = 1;
+    for (i = 0; i < LAT_BUCKETS; i++) {
+        seen += hist->buckets[i];
+        if (seen >= rank)
+            break;
+    }
+    if (i < 2 * LAT_SUB)
+        return i;
+    int shift = (i >> LAT_SUB_SHIFT) - 1;
+    unsigned long top = ((unsigned long)(i - (shift << LAT_SUB_SHIFT) + 1) << shift) - 1;
+    return (top < hist->max) ? top : hist->max;
+}
+
+/*
+ * eval_mm_stream - Check, measure and time the mm package on a trace too large for memory
+ *    The trace is read STREAM_WINDOW requests at a time and its live
+ *    blocks are kept in an id map, so the driver needs memory for the
+ *    live blocks, not for the whole trace. A first pass checks every
+ *    request as eval_mm_valid does and measures the space utilization
+ *    as eval_mm_util does. The trace is then rewound and replayed
+ *    without checks, timing the mm calls of each window. A pipe cannot
+ *    be rewound, so there the time is that of the checked pass.
+ *    The peak resident size is not measured, as the range records of
+ *    the checks would count next to the heap.
+ *    Returns the weight of the trace.
+ */
+static int eval_mm_stream(char *tracedir, char *filename, int tracenum,
+                          stats_t *stats, range_t **ranges) {
+    char path[500];
+    tstream_t *s;
+    traceop_t *window;
+    idmap_t live = {NULL, 0, 0};
+    struct timespec start, end;
+    int i, n, weight;
+    int total_size = 0, max_total_size = FREE_HEAP;
+    long opnum = 0;
+    double secs = 0;
+
+    if (verbose > 1)
+        printf("Streaming tracefile: %s\n", filename);
+    s = open_trace_stream(trace_path(path, tracedir, filename));
+    weight = s->weight;
+    if ((window = (traceop_t *)malloc(STREAM_WINDOW * sizeof(traceop_t))) == NULL)
+        unix_error("malloc error in eval_mm_stream");
+
+    /* Reset the heap and free any records in the range tree */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    idmap_clear(&live);
+    stats->valid = 0;
+    if (mm_init() < 0) {
+        malloc_error(tracenum, 0, "mm_init failed.");
+        goto done;
+    }
+
+    if (verbose > 1)
+        printf("Checking mm_malloc for correctness and efficiency, ");
+    while ((n = read_trace_window(s, window, STREAM_WINDOW)) > 0) {
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        for (i = 0; i < n; i++, opnum++) {
+            if (!stream_valid_op(&window[i], tracenum, opnum, ranges, &live, &total_size))
+                goto done;
+            max_total_size = (total_size > max_total_size) ? total_size : max_total_size;
+        }
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    }
+    stats->valid = 1;
+    stats->ops = s->ops_read;
+    stats->max_heap = mem_peak_heapsize() > FREE_HEAP ? mem_peak_heapsize() : FREE_HEAP;
+    stats->ideal_max_heap = max_total_size;
+    stats->util = (double)stats->ideal_max_heap / (double)stats->max_heap;
+    stats->heap_grows = mem_grow_count();
+    /* the free lists are not walked at the peak of a stream, which is timed */
+    if (heap_stats)
+        stats->heap_counted = mm_stats(&stats->heap_at_end) == 0;
+
+    if (rewind_trace_stream(s) == 0) {
+        if (verbose > 1)
+            printf("and performance.\n");
+        mem_reset_brk();
+        idmap_clear(&live);
+        if (mm_init() < 0)
+            app_error("mm_init failed in eval_mm_stream");
+        secs = 0;
+        while ((n = read_trace_window(s, window, STREAM_WINDOW)) > 0) {
+            clock_gettime(CLOCK_MONOTONIC, &start);
+            for (i = 0; i < n; i++)
+                stream_speed_op(&window[i], &live);
+            clock_gettime(CLOCK_MONOTONIC, &end);
+            secs += (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+        }
+    } else if (verbose > 1) {
+        printf("and performance, counting the checks.\n");
+    }
+    stats->secs = secs;
+
+done:
+    free(live.slots);
+    free(window);
+    close_trace_stream(s);
+    return weight;
+}
+
+/*
+ * stream_valid_op - Run one request of a streamed trace and check it as eval_mm_valid does
+ *    Keeps the total payload size of the live blocks in *total_size.
+ *    Returns 0 when the mm package got the request wrong.
+ */
+static int stream_valid_op(traceop_t *op, int tracenum, int opnum,
+                           range_t **ranges, idmap_t *live, int *total_size) {
+    void *old_lo = mem_heap_lo();
+    idslot_t *slot = idmap_find(live, op->index);
+    int j, oldsize;
+    char *p;
+
+    if ((op->type == ALLOC) != (slot == NULL)) {
+        sprintf(msg, "Request on line %d of the trace is for id %d, which is %s",
+                LINENUM(opnum), op->index, slot == NULL ? "not allocated" : "allocated already");
+        app_error(msg);
+    }
+
+    switch (op->type) {
+
+    case ALLOC: /* mm_malloc */
+        if ((p = mm_malloc(op->size)) == NULL) {
+            malloc_error(tracenum, opnum, "mm_malloc failed.");
+            return 0;
+        }
+        if (add_range(ranges, p, op->size, tracenum, opnum) == 0)
+            return 0;
+        memset(p, op->index & 0xFF, op->size);
+        slot = idmap_add(live, op->index);
+        slot->p = p;
+        slot->size = op->size;
+        *total_size += op->size;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        if ((p = mm_realloc(slot->p, op->size)) == NULL) {
+            malloc_error(tracenum, opnum, "mm_realloc failed.");
+            return 0;
+        }
+        remove_range(ranges, slot->p);
+        if (add_range(ranges, p, op->size, tracenum, opnum) == 0)
+            return 0;
+        oldsize = (op->size < slot->size) ? op->size : slot->size;
+        for (j = 0; j < oldsize; j++) {
+            if ((unsigned char)p[j] != (op->index & 0xFF)) {
+                malloc_error(tracenum, opnum, "mm_realloc did not preserve the "
+                                              "data from old block");
+                return 0;
+            }
+        }
+        memset(p, op->index & 0xFF, op->size);
+        *total_size += op->size - slot->size;
+        slot->p = p;
+        slot->size = op->size;
+        break;
+
+    case FREE: /* mm_free */
+        remove_range(ranges, slot->p);
+        mm_free(slot->p);
+        *total_size -= slot->size;
+        idmap_remove(live, slot);
+        break;
+
+    default:
+        app_error("Nonexistent request type in eval_mm_stream");
+    }
+    if (old_lo != mem_heap_lo())
+        app_error("Error, tampering with mem_heap_lo");
+    return 1;
+}
+
+/*
+ * stream_speed_op - Run one request of a streamed trace without any checks
+ */
+static void stream_speed_op(traceop_t *op, idmap_t *live) {
+    idslot_t *slot;
+    char *p;
+
+    switch (op->type) {
+
+    case ALLOC: /* mm_malloc */
+        if ((p = mm_malloc(op->size)) == NULL)
+            app_error("mm_malloc error in eval_mm_stream");
+        idmap_add(live, op->index)->p = p;
+        break;
+
+    case REALLOC: /* mm_realloc */
+        slot = idmap_find(live, op->index);
+        if ((p = mm_realloc(slot->p, op->size)) == NULL)
+            app_error("mm_realloc error in eval_mm_stream");
+        slot->p = p;
+        break;
+
+    case FREE: /* mm_free */
+        slot = idmap_find(live, op->index);
+        mm_free(slot->p);
+        idmap_remove(live, slot);
+        break;
+
+    default:
+        app_error("Nonexistent request type in eval_mm_stream");
+    }
+}
+
 /*
  * eval_libc_valid - We run this function to make sure that the
  *    libc malloc can run to completion on the set of traces.
@@ -943,6 +1996,56 @@ static void eval_libc_speed(void *ptr) {
     }
 }
 
+/*
+ * rss_start - Give back the pages of the old heap and restart the peak RSS of the process
+ *    Returns the resident set size in kB the heap is measured against, -1 when
+ *    /proc does not tell the peak or cannot reset it.
+ */
+static long rss_start(void) {
+    FILE *f;
+
+    mem_decommit(mem_heap_lo(), mem_heapsize());
+    /* writing 5 resets VmHWM to the current resident set size */
+    if ((f = fopen("/proc/self/clear_refs", "w")) == NULL)
+        return -1;
+    fputs("5", f);
+    if (fclose(f) != 0)
+        return -1;
+    return proc_status_kb("VmRSS:");
+}
+
+/*
+ * rss_peak - How many bytes the peak RSS of the process grew by since rss_start returned base
+ *    Returns 0 when it is unknown.
+ */
+static long rss_peak(long base) {
+    long hwm;
+
+    if (base < 0 || (hwm = proc_status_kb("VmHWM:")) < 0)
+        return 0;
+    return (hwm > base) ? (hwm - base) * 1024 : 0;
+}
+
+/*
+ * proc_status_kb - The value in kB of a field of /proc/self/status, -1 if it is missing
+ */
+static long proc_status_kb(char *field) {
+    FILE *f;
+    char line[MAXLINE];
+    long kb = -1;
+
+    if ((f = fopen("/proc/self/status", "r")) == NULL)
+        return -1;
+    while (fgets(line, MAXLINE, f) != NULL) {
+        if (strncmp(line, field, strlen(field)) == 0) {
+            kb = atol(line + strlen(field));
+            break;
+        }
+    }
+    fclose(f);
+    return kb;
+}
+
 /*************************************
  * Some miscellaneous helper routines
  ************************************/
@@ -957,15 +2060,20 @@ static void printresults(int n, stats_t *stats) {
     double util = 0;
 
     /* Print the individual results for each trace */
-    printf("%35s%7s %9s%8s%5s %8s%10s%6s\n",
-           "trace", " valid", "idealheap", "maxheap", "util", "ops", "secs", "Kops");
+    printf("%35s%7s %9s%8s%8s%6s%5s %8s%10s%6s\n",
+           "trace", " valid", "idealheap", "maxheap", "peakrss", "grows", "util", "ops", "secs", "Kops");
     for (i = 0; i < n; i++) {
         if (stats[i].valid) {
-            printf("%35s%7s %8.0fk%7.0fk%5.0f%%%8.0f%10.6f%6.0f\n",
+            char rss[16] = "-";
+            if (stats[i].peak_rss > 0)
+                snprintf(rss, sizeof(rss), "%.0fk", (double)(stats[i].peak_rss) / 1024.0);
+            printf("%35s%7s %8.0fk%7.0fk%8s%6ld%5.0f%%%8.0f%10.6f%6.0f\n",
                    stats[i].filename,
                    "yes",
                    (double)(stats[i].ideal_max_heap) / 1024.0,
                    (double)(stats[i].max_heap) / 1024.0,
+                   rss,
+                   stats[i].heap_grows,
                    stats[i].util * 100.0,
                    stats[i].ops,
                    stats[i].secs,
@@ -986,7 +2094,7 @@ static void printresults(int n, stats_t *stats) {
 
     /* Print the aggregate results for the set of traces */
     if (errors == 0) {
-        printf("%42s%18s%5.0f%%%8.0f%10.6f%6.0f\n",
+        printf("%42s%32s%5.0f%%%8.0f%10.6f%6.0f\n",
                "Total       ",
                " ",
                (util / n) * 100.0,
@@ -1003,6 +2111,40 @@ static void printresults(int n, stats_t *stats) {
     }
 }
 
+/*
+ * printrealloc - prints the realloc summary of the traces with reallocs
+ The secs are the median of the trials, with -n the 95% confidence interval of the mean
+ throughput follows.
+ */
+static void printrealloc(int n, stats_t *stats) {
+    int i;
+
+    for (i = 0; i < n; i++)
+        if (stats[i].valid && stats[i].realloc_ops > 0)
+            break;
+    if (i == n)
+        return;
+
+    printf("Realloc results for mm malloc:\n");
+    printf("%35s%10s%8s%10s%6s%11s%s\n",
+           "trace", "reallocs", "moved", "secs", "Kops", "copied/op", (trials > 1) ? "     95% CI" : "");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].realloc_ops == 0)
+            continue;
+        printf("%35s%10.0f%7.0f%%%10.6f%6.0f%11.0f",
+               stats[i].filename,
+               stats[i].realloc_ops,
+               stats[i].realloc_moved / stats[i].realloc_ops * 100.0,
+               stats[i].realloc_secs,
+               (stats[i].realloc_ops / 1e3) / stats[i].realloc_secs,
+               stats[i].realloc_copied / stats[i].realloc_ops);
+        if (trials > 1)
+            printf("%5s%-6.0f", "+-", stats[i].realloc_kops_ci95);
+        printf("\n");
+    }
+    printf("\n");
+}
+
 /*
  * app_error - Report an arbitrary application error
  */
@@ -1027,18 +2169,336 @@ void malloc_error(int tracenum, int opnum, char *msg) {
     printf("ERROR [trace %d, line %d]: %s\n", tracenum, LINENUM(opnum), msg);
 }
 
+/*
+ * printlatency - Print percentiles of the cycles each type of call took on each trace
+ The histograms hold the cycles as timed, the percentiles printed are less the counter
+ overhead, which is the least any timing took, so they are never negative in practice.
+ */
+static void printlatency(int n, stats_t *stats) {
+    static char *names[] = {"malloc", "free", "realloc"};
+    int i, type;
+
+    printf("Latency results for mm malloc (cycles per call, less %lu of counter overhead):\n", counter_ovhd);
+    printf("%35s%9s%9s%8s%8s%8s%10s\n",
+           "trace", "call", "calls", "p50", "p99", "p99.9", "max");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].latency == NULL)
+            continue;
+        for (type = ALLOC; type <= REALLOC; type++) {
+            lat_hist_t *hist = &stats[i].latency[type];
+            if (hist->count == 0)
+                continue;
+            printf("%35s%9s%9lu%8ld%8ld%8ld%10ld\n",
+                   (type == ALLOC) ? stats[i].filename : "",
+                   names[type],
+                   hist->count,
+                   (long)(lat_percentile(hist, 0.50) - counter_ovhd),
+                   (long)(lat_percentile(hist, 0.99) - counter_ovhd),
+                   (long)(lat_percentile(hist, 0.999) - counter_ovhd),
+                   (long)(hist->max - counter_ovhd));
+        }
+    }
+    printf("\n");
+}
+
+/*
+ * printperf - Print the hardware events per request of each trace
+ The pages are those of the largest heap of the trace, to set the dTLB misses against.
+ */
+static void printperf(int n, stats_t *stats) {
+    /* the columns after the trace: event, width and decimals */
+    static const int cols[][3] = {{PERF_INSTRUCTIONS, 8, 0}, {PERF_CYCLES, 8, 0},
+                                  {PERF_BRANCH_MISSES, 9, 2}, {PERF_L1D_MISSES, 8, 2},
+                                  {PERF_LLC_MISSES, 8, 2}, {PERF_DTLB_MISSES, 8, 2},
+                                  {PERF_PAGE_FAULTS, 8, 3}};
+    int i, c;
+
+    printf("Hardware events of mm malloc (per request):\n");
+    printf("%35s%8s%8s%9s%8s%8s%8s%8s%6s%8s\n",
+           "trace", "instrs", "cycles", "br-miss", "L1D", "LLC", "dTLB", "faults", "IPC", "pages");
+    for (i = 0; i < n; i++) {
+        double *p = stats[i].perf;
+        if (!stats[i].valid)
+            continue;
+        printf("%35s", stats[i].filename);
+        for (c = 0; c < PERF_EVENTS; c++)
+            if (p[cols[c][0]] < 0)
+                printf("%*s", cols[c][1], "-");
+            else
+                printf("%*.*f", cols[c][1], cols[c][2], p[cols[c][0]]);
+        if (p[PERF_INSTRUCTIONS] < 0 || p[PERF_CYCLES] <= 0)
+            printf("%6s", "-");
+        else
+            printf("%6.2f", p[PERF_INSTRUCTIONS] / p[PERF_CYCLES]);
+        printf("%8d\n", stats[i].max_heap / getpagesize());
+    }
+    printf("\n");
+}
+
+/*
+ * printparallel - Print the throughput of the parallel replay of each trace
+ The speedup is the throughput of jobs threads over that of one thread and the
+ efficiency that speedup per thread.
+ */
+static void printparallel(int n, stats_t *stats) {
+    int i;
+
+    printf("Parallel results for mm malloc, %d threads%s:\n", jobs, cross ? " freeing each other's blocks" : "");
+    printf("%35s%10s%10s%9s%7s%11s%11s\n",
+           "trace", "Kops(1)", "Kops(n)", "speedup", "eff", "slowest", "lockwaits");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid || stats[i].par_secs == 0)
+            continue;
+        double kops1 = stats[i].ops / 1e3 / stats[i].par_secs1;
+        double kops = jobs * stats[i].ops / 1e3 / stats[i].par_secs;
+        printf("%35s%10.0f%10.0f%9.2f%6.0f%%%11.6f%11lu\n",
+               stats[i].filename,
+               kops1,
+               kops,
+               kops / kops1,
+               kops / kops1 / jobs * 100.0,
+               stats[i].par_slowest,
+               stats[i].par_waits);
+    }
+    printf("\n");
+}
+
+/*
+ * printtrials - Print the spread of the throughput of each trace over the trials
+ */
+static void printtrials(int n, stats_t *stats) {
+    int i;
+
+    printf("Timing results for mm malloc, %d trials after %d warmup runs:\n", trials, warmup);
+    printf("%35s%9s%9s%9s%11s\n", "trace", "Kops", "mean", "stddev", "95% CI");
+    for (i = 0; i < n; i++) {
+        if (!stats[i].valid)
+            continue;
+        printf("%35s%9.0f%9.0f%9.0f%5s%-6.0f\n",
+               stats[i].filename,
+               (stats[i].ops / 1e3) / stats[i].secs,
+               stats[i].kops_mean,
+               stats[i].kops_stddev,
+               "+-",
+               stats[i].kops_ci95);
+    }
+    printf("\n");
+}
+
+/*
+ * trial_summary - Set the secs of a trace to the median of its trials and sum up their spread
+ The secs of its reallocs are summed up the same way.
+ */
+static void trial_summary(stats_t *stats) {
+    double mean, stddev;
+
+    stats->secs = trial_spread(stats->trial_secs, stats->ops,
+                               &stats->kops_mean, &stats->kops_stddev, &stats->kops_ci95);
+    if (stats->realloc_ops > 0)
+        stats->realloc_secs = trial_spread(stats->trial_realloc_secs, stats->realloc_ops,
+                                           &mean, &stddev, &stats->realloc_kops_ci95);
+}
+
+/*
+ * trial_spread - Median of the secs of the trials of ops requests, and the mean throughput
+ with its standard deviation and confidence interval, from Student's t distribution
+ */
+static double trial_spread(double *secs, double ops, double *mean, double *stddev, double *ci95) {
+    /* two sided 97.5% quantiles of the t distribution with 1 to 30 degrees of freedom */
+    static const double t975[] = {12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306,
+                                  2.262, 2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120,
+                                  2.110, 2.101, 2.093, 2.086, 2.080, 2.074, 2.069, 2.064,
+                                  2.060, 2.056, 2.052, 2.048, 2.045, 2.042};
+    int n = trials, i;
+    double sorted[n], sum = 0, squares = 0;
+
+    for (i = 0; i < n; i++) {
+        sorted[i] = secs[i];
+        sum += (ops / 1e3) / secs[i];
+    }
+    qsort(sorted, n, sizeof(double), compare_secs);
+    *mean = sum / n;
+    *stddev = 0;
+    *ci95 = 0;
+    if (n >= 2) {
+        for (i = 0; i < n; i++) {
+            double d = (ops / 1e3) / secs[i] - *mean;
+            squares += d * d;
+        }
+        *stddev = sqrt(squares / (n - 1));
+        *ci95 = (n - 1 <= 30 ? t975[n - 2] : 1.96) * *stddev / sqrt(n);
+    }
+    return (n % 2) ? sorted[n / 2] : (sorted[n / 2 - 1] + sorted[n / 2]) / 2;
+}
+
+static int compare_secs(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * write_results - Write the results of mm malloc on each trace to a file
+ A path ending in .csv gets a header line and a line per trace, any other a JSON
+ object holding the settings, the score and a record per trace with its trials.
+ */
+static void write_results(char *path, int n, stats_t *stats, double perfindex) {
+    size_t len = strlen(path);
+    int csv = len >= 4 && !strcmp(path + len - 4, ".csv");
+    FILE *fp;
+    int i, j;
+
+    if ((fp = fopen(path, "w")) == NULL)
+        unix_error("Could not open the output file");
+    if (csv)
+        fprintf(fp, "trace,valid,util,ops,secs,kops,kops_mean,kops_stddev,kops_ci95,max_heap,peak_rss,heap_grows\n");
+    else
+        fprintf(fp, "{\n  \"trials\": %d,\n  \"warmup\": %d,\n  \"score\": %.0f,\n  \"traces\": [", trials, warmup, perfindex);
+    for (i = 0; i < n; i++) {
+        stats_t *t = &stats[i];
+        double kops = t->valid ? (t->ops / 1e3) / t->secs : 0;
+        if (csv) {
+            fprintf(fp, "%s,%d,%.4f,%.0f,%.9f,%.0f,%.0f,%.0f,%.0f,%d,%ld,%ld\n",
+                    t->filename, t->valid, t->util, t->ops, t->secs, kops,
+                    t->kops_mean, t->kops_stddev, t->kops_ci95, t->max_heap, t->peak_rss, t->heap_grows);
+            continue;
+        }
+        fprintf(fp, "%s\n    {\"trace\": \"", i ? "," : "");
+        for (char *c = t->filename; *c; c++)
+            fprintf(fp, (*c == '"' || *c == '\\') ? "\\%c" : "%c", *c);
+        fprintf(fp, "\", \"valid\": %s, \"util\": %.4f, \"ops\": %.0f, \"secs\": %.9f, \"kops\": %.0f, "
+                    "\"kops_mean\": %.0f, \"kops_stddev\": %.0f, \"kops_ci95\": %.0f, "
+                    "\"max_heap\": %d, \"peak_rss\": %ld, \"heap_grows\": %ld, \"trial_secs\": [",
+                t->valid ? "true" : "false", t->util, t->ops, t->secs, kops,
+                t->kops_mean, t->kops_stddev, t->kops_ci95, t->max_heap, t->peak_rss, t->heap_grows);
+        for (j = 0; t->valid && j < trials; j++)
+            fprintf(fp, "%s%.9f", j ? ", " : "", t->trial_secs[j]);
+        fprintf(fp, "]");
+        for (j = 0; t->valid && perf && j < PERF_EVENTS; j++)
+            if (t->perf[j] >= 0)
+                fprintf(fp, ", \"%s\": %.4f", perf_event_names[j], t->perf[j]);
+        fprintf(fp, "}");
+    }
+    if (!csv)
+        fprintf(fp, "\n  ]\n}\n");
+    fclose(fp);
+}
+
+/*
+ * pin_cpu - Keep the driver on one cpu, so the scheduler does not move it between trials
+ */
+static void pin_cpu(char *cpu) {
+    cpu_set_t set;
+    char *end;
+    long n = strtol(cpu, &end, 10);
+
+    if (*cpu == '\0' || *end != '\0' || n < 0 || n >= CPU_SETSIZE)
+        app_error("-c takes a cpu number");
+    CPU_ZERO(&set);
+    CPU_SET(n, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        unix_error("sched_setaffinity failed");
+}
+
+/*
+ * set_placement - Set the placement policy of mm malloc from its name
+ good:<k> is good fit comparing up to k candidates, 0 for all of them.
+ Returns what mm_set_placement returns, or -1 for an unknown name.
+ */
+static int set_placement(char *policy) {
+    char *end;
+
+    if (!strcmp(policy, "first"))
+        return mm_set_placement(MM_FIRST_FIT, 1);
+    if (!strcmp(policy, "next"))
+        return mm_set_placement(MM_NEXT_FIT, 1);
+    if (!strcmp(policy, "best"))
+        return mm_set_placement(MM_BEST_FIT, 0);
+    if (!strcmp(policy, "good"))
+        return mm_set_placement(MM_GOOD_FIT, 1);
+    if (!strncmp(policy, "good:", 5) && isdigit(policy[5])) {
+        long scan = strtol(policy + 5, &end, 10);
+        if (*end == '\0' && scan <= 1 << 20)
+            return mm_set_placement(MM_GOOD_FIT, scan);
+    }
+    return -1;
+}
+
+/*
+ * printheapstats - Print the mm_stats of each trace
+ The reallocs, searches, splits, merges and internal fragmentation (the share of the usable
+ bytes handed out that was not requested) are counted over the whole trace, only when
+ mm.c is built with MM_STATS. The external fragmentation (the share of the free bytes
+ outside the largest free block) and the free blocks are those at the peak of the
+ trace. With -V every size class with a request or free block is listed too.
+ */
+static void printheapstats(int n, stats_t *stats) {
+    int i, cls;
+
+    printf("Heap statistics for mm malloc:\n");
+    printf("%35s%9s%9s%8s%9s%9s%9s%9s%10s\n",
+           "trace", "reallocs", "fits", "probes", "splits", "merges", "intfrag", "extfrag", "freeblks");
+    for (i = 0; i < n; i++) {
+        mm_stats_t *end = &stats[i].heap_at_end;
+        mm_stats_t *peak = &stats[i].heap_at_peak;
+        unsigned long free_blocks = 0;
+
+        if (!stats[i].valid)
+            continue;
+        for (cls = 0; cls < MM_STATS_CLASSES; cls++)
+            free_blocks += peak->free_blocks[cls];
+        printf("%35s", stats[i].filename);
+        if (stats[i].heap_counted)
+            printf("%9lu%9lu%8.2f%9lu%9lu%8.1f%%",
+                   end->reallocs,
+                   end->fits,
+                   end->fits ? (double)end->probes / end->fits : 0.0,
+                   end->splits,
+                   end->coalesces,
+                   end->granted ? 100.0 * (end->granted - end->requested) / end->granted : 0.0);
+        else
+            printf("%9s%9s%8s%9s%9s%9s", "-", "-", "-", "-", "-", "-");
+        if (peak->free_bytes > 0)
+            printf("%8.1f%%%10lu\n", 100.0 * (peak->free_bytes - peak->largest_free) / peak->free_bytes, free_blocks);
+        else
+            printf("%9s%10s\n", "-", "-");
+        if (verbose < 2)
+            continue;
+        for (cls = 0; cls < MM_STATS_CLASSES; cls++) {
+            if (end->mallocs[cls] == 0 && end->frees[cls] == 0 && peak->free_blocks[cls] == 0)
+                continue;
+            printf("%35s <= %-10lu%9lu mallocs%9lu frees%9lu free at peak\n",
+                   "", 1UL << cls, end->mallocs[cls], end->frees[cls], peak->free_blocks[cls]);
+        }
+    }
+    printf("\n");
+}
+
 /*
  * usage - Explain the command line arguments
  */
 static void usage(void) {
-    fprintf(stderr, "Usage: mdriver [-hvVal] [-f <file>] [-t <dir>]\n");
+    fprintf(stderr, "Usage: mdriver [-hvVaBlLPsSx] [-f <file>] [-t <dir>] [-p <policy>] [-j <n>]\n"
+                    "               [-n <trials>] [-w <runs>] [-c <cpu>] [-o <file>] [-H <pages>]\n");
     fprintf(stderr, "Options\n");
     fprintf(stderr, "\t-a         Don't check the team structure.\n");
+    fprintf(stderr, "\t-B         Make runs of like requests with mm_malloc_bulk and mm_free_bulk.\n");
+    fprintf(stderr, "\t-c <cpu>   Run on that cpu only.\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
     fprintf(stderr, "\t-g         Generate summary info for autograder.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "\t-H <pages> Back the heap by huge pages: thp or hugetlb.\n");
+    fprintf(stderr, "\t-j <n>     Also replay each trace on n threads at once (mdriver-mt).\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-L         Time every call and print latency percentiles.\n");
+    fprintf(stderr, "\t-n <n>     Time each trace n times, report the median and confidence interval.\n");
+    fprintf(stderr, "\t-o <file>  Write the results to <file> as JSON, or CSV if it ends in .csv.\n");
+    fprintf(stderr, "\t-P         Count cache, TLB and branch misses and page faults per request.\n");
+    fprintf(stderr, "\t-p <policy> Place blocks by first, next, best or good[:<k>] fit.\n");
+    fprintf(stderr, "\t-s         Stream the traces instead of loading them, <file> - is stdin.\n");
+    fprintf(stderr, "\t-S         Print the heap statistics of each trace, -V adds size classes.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-v         Print per-trace performance breakdowns.\n");
     fprintf(stderr, "\t-V         Print additional debug info.\n");
+    fprintf(stderr, "\t-w <n>     Run each trace n times before timing it.\n");
+    fprintf(stderr, "\t-x         With -j, threads free the blocks of another thread.\n");
 }
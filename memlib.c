@@ -2,7 +2,28 @@
  * memlib.c - a module that simulates the memory system.  Needed because it 
  *            allows us to interleave calls from the student's malloc package 
  *            with the system's malloc package in libc.
+ *
+ * Built with -DMEM_MMAP=1 it is a real memory system instead, for mm.c
+ * to run as the malloc of a program (see mmpreload.c): mem_init reserves
+ * MAX_HEAP bytes of address space with mmap without committing any
+ * memory, and mem_sbrk makes the pages of the heap readable and writable
+ * as the brk pointer reaches them.
+ *
+ * The heap may be backed by huge pages instead, chosen with
+ * mem_set_pages before mem_init or built in with MEM_HUGE_PAGES:
+ * MEM_PAGES_THP maps it with mmap on a MEM_HUGE_PAGE boundary and asks
+ * for transparent huge pages with MADV_HUGEPAGE, MEM_PAGES_HUGETLB maps
+ * it from the reserved huge pages of the system with MAP_HUGETLB, and
+ * falls back to transparent huge pages when there are none. Either way
+ * the pages are only committed as they are first touched.
+ *
+ * Large allocations may live outside the heap in regions of their own,
+ * which mem_map, mem_remap and mem_unmap get from mmap in either build.
+ * The simulated memory system remembers them, so mem_is_mapped can
+ * tell which addresses they hold and mem_reset_brk unmaps them along
+ * with the heap.
  */
+#define _GNU_SOURCE /* for mremap */
 #include <stdio.h>
 #include <stdlib.h>
 #include <assert.h>
@@ -14,24 +35,98 @@
 #include "memlib.h"
 #include "config.h"
 
+#ifndef MEM_MMAP
+#define MEM_MMAP 0 /* back the heap by reserved address space instead of a malloc'd area */
+#endif
+
+#ifndef MEM_HUGE_PAGES
+#define MEM_HUGE_PAGES MEM_PAGES_SMALL /* the pages backing the heap unless mem_set_pages says otherwise */
+#endif
+
+#define MEM_HUGE_PAGE (1 << 21) /* bytes in a huge page */
+
+#define MEM_BUSY 1 /* low bit of mem_brk, set while mem_trim gives back the pages above it */
+
+/* A region of mem_map, remembered by the simulated memory system */
+typedef struct {
+    char *addr;
+    size_t size;
+} mem_region_t;
+
+static char *mem_page_up(char *addr);
+static char *mem_page_down(char *addr);
+static char *mem_brk_now(void);
+static size_t mem_unit(void);
+static char *mem_map_heap(int prot);
+static long mem_free_hugepages(void);
+static void mem_note_peak(void);
+#if !MEM_MMAP
+static void mem_add_region(char *addr, size_t size);
+static mem_region_t *mem_find_region(char *addr);
+#endif
+
 /* private variables */
 static char *mem_start_brk;  /* points to first byte of heap */
 static char *mem_brk;        /* points to last byte of heap */
+static size_t mem_mapped;    /* bytes in regions of mem_map */
+static size_t mem_peak;      /* largest heap size plus mem_mapped since the heap was last empty */
+static long mem_grows;       /* calls of mem_sbrk since the heap was last empty */
+#if !MEM_MMAP
+static mem_region_t *mem_regions; /* the regions of mem_map, in no order */
+static int mem_num_regions;
+static int mem_max_regions;
+static char mem_regions_lock;     /* spin lock guarding mem_regions */
+#endif
 static char *mem_max_addr;   /* largest legal heap address */ 
+static int mem_pages = MEM_HUGE_PAGES; /* the pages backing the heap, a MEM_PAGES_ kind */
+static int mem_heap_mapped;  /* did mmap map the heap, rather than malloc? */
+
+/*
+ * mem_set_pages - choose the pages backing the heap of the next mem_init,
+ *    a MEM_PAGES_ kind. Returns -1 for an unknown kind.
+ */
+int mem_set_pages(int kind)
+{
+    if (kind < MEM_PAGES_SMALL || kind > MEM_PAGES_HUGETLB)
+	return -1;
+    mem_pages = kind;
+    return 0;
+}
+
+/*
+ * mem_hugepagesize - returns the size of the huge pages backing the
+ *    heap, or 0 when it has pages of the system page size
+ */
+size_t mem_hugepagesize(void)
+{
+    return (mem_pages == MEM_PAGES_SMALL) ? 0 : MEM_HUGE_PAGE;
+}
 
 /* 
  * mem_init - initialize the memory system model
+ *    A heap left from an earlier mem_init is given back first.
  */
 void mem_init(void)
 {
+    if (mem_start_brk != NULL)
+	mem_deinit();
+#if MEM_MMAP
+    /* reserve the address space, pages are committed by mem_sbrk */
+    mem_start_brk = mem_map_heap(PROT_NONE);
+#else
+    if (mem_pages != MEM_PAGES_SMALL) {
+	mem_start_brk = mem_map_heap(PROT_READ | PROT_WRITE);
     /* allocate the storage we will use to model the available VM */
-    if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
+    } else if ((mem_start_brk = (char *)malloc(MAX_HEAP)) == NULL) {
 	fprintf(stderr, "mem_init_vm: malloc error\n");
 	exit(1);
     }
+#endif
 
-    mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
+    if (!mem_heap_mapped)
+	mem_max_addr = mem_start_brk + MAX_HEAP;  /* max legal heap address */
     mem_brk = mem_start_brk;                  /* heap is empty initially */
+    mem_peak = 0;
 }
 
 /* 
@@ -39,35 +134,218 @@ void mem_init(void)
  */
 void mem_deinit(void)
 {
-    free(mem_start_brk);
+    if (mem_heap_mapped)
+	munmap(mem_start_brk, MAX_HEAP);
+    else
+	free(mem_start_brk);
+    mem_start_brk = NULL;
+    mem_heap_mapped = 0;
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
+ *    With MEM_MMAP the pages of the old heap are given back to the
+ *    system and reserved again.
  */
 void mem_reset_brk()
 {
+#if MEM_MMAP
+    size_t used = mem_page_up(mem_brk) - mem_start_brk;
+    madvise(mem_start_brk, used, MADV_DONTNEED);
+    mprotect(mem_start_brk, used, PROT_NONE);
+#else
+    for (int i = 0; i < mem_num_regions; i++)
+	munmap(mem_regions[i].addr, mem_regions[i].size);
+    mem_num_regions = 0;
+    mem_mapped = 0;
+#endif
     mem_brk = mem_start_brk;
+    mem_peak = 0;
+    mem_grows = 0;
 }
 
 /* 
  * mem_sbrk - simple model of the sbrk function. Extends the heap 
  *    by incr bytes and returns the start address of the new area. In
- *    this model, the heap cannot be shrunk.
+ *    this model, the heap is only shrunk by mem_trim.
+ *    The brk pointer is advanced with a compare and swap, so threads
+ *    (e.g. the arenas of mm.c) may call it concurrently and always get
+ *    disjoint areas.
+ *    With MEM_MMAP the pages of the new area are committed before the
+ *    brk pointer moves past them. Committing a page twice does no harm,
+ *    so a thread that loses the race simply tries again further up.
  */
 void *mem_sbrk(int incr) 
 {
-    char *old_brk = mem_brk;
+    char *old_brk;
 
-    if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
-	errno = ENOMEM;
-	fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
-	return (void *)-1;
+    for (;;) {
+	old_brk = __atomic_load_n(&mem_brk, __ATOMIC_ACQUIRE);
+	if ((uintptr_t)old_brk & MEM_BUSY)
+	    continue; /* wait for mem_trim to give back the pages above it */
+	if ( (incr < 0) || ((old_brk + incr) > mem_max_addr)) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+#if MEM_MMAP
+	char *page = mem_page_down(old_brk);
+	if (incr > 0 && mprotect(page, mem_page_up(old_brk + incr) - page,
+				 PROT_READ | PROT_WRITE) < 0) {
+	    errno = ENOMEM;
+	    fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
+	    return (void *)-1;
+	}
+#endif
+	if (__atomic_compare_exchange_n(&mem_brk, &old_brk, old_brk + incr, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	    break;
     }
-    mem_brk += incr;
+    mem_note_peak();
+    __atomic_fetch_add(&mem_grows, 1, __ATOMIC_RELAXED);
     return (void *)old_brk;
 }
 
+/*
+ * mem_trim - give back the len bytes of the heap below end, which must
+ *    be the top of the heap. Returns 0 when the brk pointer moved down to
+ *    end - len and -1 when the heap does not end at end, e.g. because
+ *    another thread extended it in the meantime.
+ *    While the pages are given back the brk pointer is marked busy, so
+ *    no thread can be handed them by mem_sbrk before they are gone.
+ */
+int mem_trim(void *end, size_t len)
+{
+    char *old_brk = end;
+    char *new_brk = (char *)end - len;
+
+    if (new_brk < mem_start_brk ||
+	!__atomic_compare_exchange_n(&mem_brk, &old_brk, (char *)((uintptr_t)new_brk | MEM_BUSY),
+				     0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+	return -1;
+    mem_decommit(new_brk, len);
+#if MEM_MMAP
+    char *page = mem_page_up(new_brk);
+    if (mem_page_up(end) > page)
+	mprotect(page, mem_page_up(end) - page, PROT_NONE);
+#endif
+    __atomic_store_n(&mem_brk, new_brk, __ATOMIC_RELEASE);
+    return 0;
+}
+
+/*
+ * mem_decommit - give the whole pages between start and start + len
+ *    back to the system. They stay part of the heap and read as zeros
+ *    when they are next touched.
+ */
+void mem_decommit(void *start, size_t len)
+{
+    char *lo = mem_page_up(start);
+    char *hi = mem_page_down((char *)start + len);
+
+    if (hi > lo)
+	madvise(lo, hi - lo, MADV_DONTNEED);
+}
+
+/*
+ * mem_map - map a region of size bytes, a multiple of the page size,
+ *    outside the heap. Returns NULL when there is no memory for it.
+ */
+void *mem_map(size_t size)
+{
+    char *addr = mmap(NULL, size, PROT_READ | PROT_WRITE,
+		      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (addr == MAP_FAILED)
+	return NULL;
+#if !MEM_MMAP
+    mem_add_region(addr, size);
+#endif
+    __atomic_fetch_add(&mem_mapped, size, __ATOMIC_RELAXED);
+    mem_note_peak();
+    return addr;
+}
+
+/*
+ * mem_remap - resize a region of mem_map from old_size to new_size
+ *    bytes, moving it when it cannot grow where it is. Returns the
+ *    region's address, or NULL, leaving it as it was, when there is
+ *    no memory for it.
+ */
+void *mem_remap(void *addr, size_t old_size, size_t new_size)
+{
+    char *new_addr = mremap(addr, old_size, new_size, MREMAP_MAYMOVE);
+
+    if (new_addr == MAP_FAILED)
+	return NULL;
+#if !MEM_MMAP
+    mem_region_t *region;
+    while (__atomic_test_and_set(&mem_regions_lock, __ATOMIC_ACQUIRE))
+	;
+    region = mem_find_region(addr);
+    region->addr = new_addr;
+    region->size = new_size;
+    __atomic_clear(&mem_regions_lock, __ATOMIC_RELEASE);
+#endif
+    if (new_size > old_size)
+	__atomic_fetch_add(&mem_mapped, new_size - old_size, __ATOMIC_RELAXED);
+    else
+	__atomic_fetch_sub(&mem_mapped, old_size - new_size, __ATOMIC_RELAXED);
+    mem_note_peak();
+    return new_addr;
+}
+
+/*
+ * mem_unmap - give back a region of size bytes that mem_map returned
+ */
+void mem_unmap(void *addr, size_t size)
+{
+#if !MEM_MMAP
+    while (__atomic_test_and_set(&mem_regions_lock, __ATOMIC_ACQUIRE))
+	;
+    *mem_find_region(addr) = mem_regions[--mem_num_regions];
+    __atomic_clear(&mem_regions_lock, __ATOMIC_RELEASE);
+#endif
+    munmap(addr, size);
+    __atomic_fetch_sub(&mem_mapped, size, __ATOMIC_RELAXED);
+}
+
+/*
+ * mem_is_mapped - is [lo, hi] inside one region of mem_map? Always 0
+ *    with MEM_MMAP, which does not remember the regions.
+ */
+int mem_is_mapped(void *lo, void *hi)
+{
+    int found = 0;
+#if !MEM_MMAP
+    while (__atomic_test_and_set(&mem_regions_lock, __ATOMIC_ACQUIRE))
+	;
+    for (int i = 0; i < mem_num_regions && !found; i++)
+	found = (char *)lo >= mem_regions[i].addr &&
+		(char *)hi < mem_regions[i].addr + mem_regions[i].size;
+    __atomic_clear(&mem_regions_lock, __ATOMIC_RELEASE);
+#endif
+    return found;
+}
+
+/*
+ * mem_peak_heapsize - returns the largest size in bytes the heap had,
+ *    together with the regions of mem_map, since it was last reset
+ */
+size_t mem_peak_heapsize()
+{
+    return mem_peak;
+}
+
+/*
+ * mem_grow_count - returns how many times mem_sbrk extended the heap
+ *    since it was last reset
+ */
+long mem_grow_count()
+{
+    return mem_grows;
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -81,7 +359,7 @@ void *mem_heap_lo()
  */
 void *mem_heap_hi()
 {
-    return (void *)(mem_brk - 1);
+    return (void *)(mem_brk_now() - 1);
 }
 
 /*
@@ -89,7 +367,7 @@ void *mem_heap_hi()
  */
 size_t mem_heapsize() 
 {
-    return (size_t)(mem_brk - mem_start_brk);
+    return (size_t)(mem_brk_now() - mem_start_brk);
 }
 
 /*
@@ -99,3 +377,151 @@ size_t mem_pagesize()
 {
     return (size_t)getpagesize();
 }
+
+/*
+ * mem_page_up - round a heap address up to the start of a page
+ */
+static char *mem_page_up(char *addr)
+{
+    uintptr_t mask = mem_unit() - 1;
+    return (char *)(((uintptr_t)addr + mask) & ~mask);
+}
+
+/*
+ * mem_page_down - round a heap address down to the start of a page
+ */
+static char *mem_page_down(char *addr)
+{
+    return (char *)((uintptr_t)addr & ~(uintptr_t)(mem_unit() - 1));
+}
+
+/*
+ * mem_unit - the size of the pages of the heap, which mprotect and
+ *    madvise work in: huge pages from MAP_HUGETLB cannot be split
+ */
+static size_t mem_unit(void)
+{
+    return (mem_pages == MEM_PAGES_HUGETLB) ? MEM_HUGE_PAGE : mem_pagesize();
+}
+
+/*
+ * mem_map_heap - map MAX_HEAP bytes for the heap with the given protection
+ *    The mapping reserves no swap, so only the pages touched are
+ *    committed. With huge pages it takes a huge page more than the heap
+ *    and trims it to start on a huge page, so that every aligned huge
+ *    page of the heap can be a transparent huge page. MAP_HUGETLB then
+ *    maps as much of the heap as there are free huge pages over its
+ *    start, reserving them so they cannot run out under the heap, and
+ *    mem_max_addr ends the heap there; the rest stays reserved address
+ *    space, so nothing else is mapped where mm.c expects its heap.
+ */
+static char *mem_map_heap(int prot)
+{
+    int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+    size_t slack = (mem_pages == MEM_PAGES_SMALL) ? 0 : MEM_HUGE_PAGE;
+    char *addr, *start;
+
+    if ((addr = mmap(NULL, MAX_HEAP + slack, prot, flags, -1, 0)) == MAP_FAILED) {
+	fprintf(stderr, "mem_init_vm: mmap error\n");
+	exit(1);
+    }
+    mem_heap_mapped = 1;
+    mem_max_addr = addr + MAX_HEAP;
+    if (slack == 0)
+	return addr;
+    start = (char *)(((uintptr_t)addr + slack - 1) & ~(uintptr_t)(slack - 1));
+    if (start > addr)
+	munmap(addr, start - addr);
+    if (start < addr + slack)
+	munmap(start + MAX_HEAP, addr + slack - start);
+    mem_max_addr = start + MAX_HEAP;
+    if (mem_pages == MEM_PAGES_HUGETLB) {
+	size_t size = mem_free_hugepages() * MEM_HUGE_PAGE;
+	if (size > MAX_HEAP)
+	    size = MAX_HEAP;
+	if (size > 0 && mmap(start, size, prot, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED | MAP_HUGETLB,
+			     -1, 0) != MAP_FAILED) {
+	    mem_max_addr = start + size;
+	    return start;
+	}
+	fprintf(stderr, "mem_init_vm: no huge pages for MAP_HUGETLB, using MADV_HUGEPAGE\n");
+	mem_pages = MEM_PAGES_THP;
+    }
+    madvise(start, MAX_HEAP, MADV_HUGEPAGE);
+    return start;
+}
+
+/*
+ * mem_free_hugepages - the number of huge pages the system has free for MAP_HUGETLB
+ */
+static long mem_free_hugepages(void)
+{
+    FILE *fp = fopen("/proc/meminfo", "r");
+    char line[128];
+    long pages = 0;
+
+    if (fp == NULL)
+	return 0;
+    while (fgets(line, sizeof(line), fp) != NULL)
+	if (sscanf(line, "HugePages_Free: %ld", &pages) == 1)
+	    break;
+    fclose(fp);
+    return pages;
+}
+
+/*
+ * mem_brk_now - the brk pointer without its busy mark
+ */
+static char *mem_brk_now(void)
+{
+    return (char *)((uintptr_t)__atomic_load_n(&mem_brk, __ATOMIC_RELAXED) & ~(uintptr_t)MEM_BUSY);
+}
+
+/*
+ * mem_note_peak - raise mem_peak to the current heap size plus mem_mapped
+ */
+static void mem_note_peak(void)
+{
+    size_t size = mem_heapsize() + __atomic_load_n(&mem_mapped, __ATOMIC_RELAXED);
+    size_t peak = __atomic_load_n(&mem_peak, __ATOMIC_RELAXED);
+
+    while (size > peak &&
+	   !__atomic_compare_exchange_n(&mem_peak, &peak, size, 1,
+					__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+	;
+}
+
+#if !MEM_MMAP
+/*
+ * mem_add_region - remember a new region of mem_map
+ */
+static void mem_add_region(char *addr, size_t size)
+{
+    while (__atomic_test_and_set(&mem_regions_lock, __ATOMIC_ACQUIRE))
+	;
+    if (mem_num_regions == mem_max_regions) {
+	mem_max_regions = mem_max_regions ? 2 * mem_max_regions : 64;
+	mem_regions = realloc(mem_regions, mem_max_regions * sizeof(mem_region_t));
+	if (mem_regions == NULL) {
+	    fprintf(stderr, "mem_map: realloc error\n");
+	    exit(1);
+	}
+    }
+    mem_regions[mem_num_regions].addr = addr;
+    mem_regions[mem_num_regions].size = size;
+    mem_num_regions++;
+    __atomic_clear(&mem_regions_lock, __ATOMIC_RELEASE);
+}
+
+/*
+ * mem_find_region - the remembered region starting at addr, the lock must be held
+ */
+static mem_region_t *mem_find_region(char *addr)
+{
+    int i;
+
+    for (i = 0; mem_regions[i].addr != addr; i++)
+	;
+    return &mem_regions[i];
+}
+#endif
@@ -1,12 +1,25 @@
 #include <unistd.h>
 #include <stdint.h>
 
+/* The pages backing the heap, see mem_set_pages */
+enum { MEM_PAGES_SMALL, MEM_PAGES_THP, MEM_PAGES_HUGETLB };
+
+int mem_set_pages(int kind);
+size_t mem_hugepagesize(void);
 void mem_init(void);               
 void mem_deinit(void);
 void *mem_sbrk(int incr);
+int mem_trim(void *end, size_t len);
+void mem_decommit(void *start, size_t len);
+void *mem_map(size_t size);
+void *mem_remap(void *addr, size_t old_size, size_t new_size);
+void mem_unmap(void *addr, size_t size);
+int mem_is_mapped(void *lo, void *hi);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+long mem_grow_count(void);
 size_t mem_pagesize(void);
 
@@ -1,31 +1,114 @@
-
-
 /*
- * mm.c -  Simple allocator based on implicit free lists,
- *         first fit placement, and boundary tag coalescing.
+ * mm.c -  Allocator based on segregated explicit free lists,
+ *         good fit placement through a two level bitmap of the
+ *         size classes, and boundary tag coalescing.
  *
- * Each block has header and footer of the form:
+ * Each block starts with a 4 byte header of the form:
  *
- *      63       32   31        1   0
- *      --------------------------------
- *     |   unused   | block_size | a/f |
- *      --------------------------------
+ *      31        2     1      0
+ *      ------------------------------
+ *     | block_size | prev a/f | a/f |
+ *      ------------------------------
  *
- * a/f is 1 iff the block is allocated. The list has the following form:
+ * a/f is 1 iff the block is allocated and prev a/f is 1 iff the block
+ * right before it is allocated. Only free blocks repeat their size in a
+ * footer in their last 4 bytes; an allocated block has no footer, so
+ * its payload runs up to the next header and the overhead of an
+ * allocation is just its header. Blocks start 4 bytes before a multiple
+ * of MM_ALIGNMENT (8 by default) so their payloads stay aligned, and
+ * every block size is a multiple of MM_ALIGNMENT. A segment of the heap
+ * has the following form:
  *
- * begin                                       end
- * heap                                       heap
- *  ----------------------------------------------
- * | hdr(8:a) | zero or more usr blks | hdr(0:a) |
- *  ----------------------------------------------
- * | prologue |                       | epilogue |
- * | block    |                       | block    |
+ * begin                                                      end
+ * segment                                                segment
+ *  -------------------------------------------------------------
+ * | pad | hdr(8:a) ftr(8:a) | zero or more usr blks | hdr(0:a) |
+ *  -------------------------------------------------------------
+ *       |      prologue     |                       | epilogue |
+ *       |      block        |                       | block    |
  *
  * The allocated prologue and epilogue blocks are overhead that
  * eliminate edge conditions during coalescing.
+ *
+ * Free blocks keep a next and prev pointer in their payload and are
+ * linked into one of NUM_CLASSES doubly linked, NULL terminated lists,
+ * indexed in two levels as in TLSF. The first level splits sizes by
+ * power of two and the second level splits each power of two range
+ * into SL_COUNT equal classes. A bitmap per level records which lists
+ * are not empty, so the first usable class is found with two bit scans.
+ * Which block of the lists a request gets is up to the placement policy
+ * set with mm_set_placement: good fit by default, or first, next or best
+ * fit within the class of the request.
+ *
+ * Requests of up to SLAB_MAX_SIZE bytes are served by slab runs
+ * instead. A run is a RUN_SIZE page holding objects of one size class
+ * with no header or footer, tracked by a free bitmap in a run header at
+ * the start of the page. Each run is the payload of an allocated block
+ * placed so the payload starts on a page, and run_map marks every page
+ * that is a run, so mm_free tells slab objects from blocks by their
+ * address. A run whose objects are all free goes back to the heap as
+ * an ordinary block.
+ *
+ * The free lists belong to an arena. When built with MM_THREADS there
+ * are up to MM_ARENAS arenas, each with its own lock, and threads are
+ * spread over them round robin. An arena grows by whole ARENA_GRANULE
+ * units of mem_sbrk. When the new memory does not follow its last
+ * segment it starts a new segment with its own prologue and epilogue,
+ * so the heap becomes a sequence of segments of different arenas.
+ * arena_map records the owner of every granule, so a block freed by
+ * any thread goes back to the arena it came from.
+ *
+ * Requests of MM_MMAP_THRESHOLD bytes or more bypass the heap. Each
+ * gets a region of mem_map, which starts with the size of the region
+ * and a tag in a MAP_HEADER_SIZE header and is unmapped again when it
+ * is freed. Such payloads are told apart by lying outside the heap, the
+ * tag lets mm_owns tell them from memory of anyone else, and mm_realloc
+ * resizes them with mem_remap, which moves the pages instead of copying
+ * the payload.
+ *
+ * When built with MM_TRIM_THRESHOLD a free block of at least that many
+ * bytes more than trim_pad gives its memory back to the system: at the
+ * top of the heap by lowering the brk pointer with mem_trim, keeping
+ * trim_pad bytes, anywhere else by decommitting the pages of its payload
+ * with mem_decommit, which stay in the heap. Only the pages a free adds
+ * to such a block are decommitted, so pages given back once are not
+ * given back again by every free next to them. Like the top pad and the
+ * dynamic trim threshold of the C library's malloc, trim_pad starts at
+ * MM_TRIM_PAD and grows by what a trim at the top gave back whenever
+ * the heap has to grow again after it, so a program that frees and
+ * reallocates the same memory in bursts soon stops trimming it. It is
+ * off by default, as the pages given back fault in again when they are
+ * reused.
+ *
+ * When built with MM_DEFER_COALESCE blocks of up to QUICK_MAX_SIZE bytes
+ * are not coalesced when they are freed. They stay marked allocated on a
+ * quick list of their arena, one per block size, and are handed out
+ * again as they are. A fit that fails, or a quick list growing past
+ * QUICK_COUNT blocks, sweeps every quick list of the arena: its blocks
+ * are freed and coalesced in one batch.
+ *
+ * When built with MM_TREE_THRESHOLD free blocks of at least that many
+ * bytes are not kept on the lists of their classes but in one treap per
+ * arena, ordered by size and then address. A request of that size or
+ * more takes the smallest block of the tree that fits and, of blocks as
+ * small, the lowest in memory, which keeps the large free blocks of a
+ * long running heap packed towards its start. The tree counts as the
+ * class of MM_TREE_THRESHOLD in the bitmaps.
+ *
+ * mm_stats reports the free lists of the heap and, when built with
+ * MM_STATS, counters of requests, searches, splits and merges kept as
+ * the allocator runs (see mm.h).
+ *
+ * In the MM_THREADS build every thread also keeps a small cache (tcache) of
+ * recently freed slab objects and blocks of up to TCACHE_MAX_SIZE
+ * bytes. Cached objects stay marked allocated, so the heap never
+ * coalesces them, and move between the cache and the arenas
+ * TCACHE_BATCH at a time.
  */
+#include "config.h"
 #include "memlib.h"
 #include "mm.h"
+#include "mm_config.h"
 #include <assert.h>
 #include <stdbool.h>
 #include <stdint.h>
@@ -33,6 +116,11 @@
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+
+#if MM_THREADS
+#include <pthread.h>
+#endif
+
 /* Your info */
 team_t team = {
     /* First and last name */
@@ -42,461 +130,2734 @@ team_t team = {
     /* Custom message (16 chars) */
     "hello",
 };
+
 typedef struct {
     uint32_t allocated : 1;
-    uint32_t block_size : 31;
-    uint32_t _;
+    uint32_t prev_allocated : 1;
+    uint32_t block_size : 30;
 } header_t;
+
 typedef header_t footer_t;
-typedef struct {
+
+/* A free list link, either a pointer or the offset of the block from heap_base (0 for NULL) */
+#if MM_COMPACT_LINKS
+typedef uint32_t link_t;
+#else
+typedef struct block_t *link_t;
+#endif
+
+/* packed so the links follow the 4 byte header, which puts them on 8 byte boundaries */
+typedef struct __attribute__((packed)) block_t {
     uint32_t allocated : 1;
-    uint32_t block_size : 31;
-    uint32_t _;
+    uint32_t prev_allocated : 1;
+    uint32_t block_size : 30;
     union {
         struct {
-            struct block_t* next;
-            struct block_t* prev;
-        };
-        int payload[0]; 
+            link_t next;
+            link_t prev;
+        } __attribute__((packed));
+        struct {
+            link_t child[2]; /* the subtrees of smaller and of larger blocks */
+            link_t parent;
+        } __attribute__((packed)) tree; /* the links of a block in the tree of MM_TREE_THRESHOLD */
+        int payload[0];
     } body;
 } block_t;
+
 /* This enum can be used to set the allocated bit in the block */
 enum block_state { FREE,
                    ALLOC };
-#define CHUNKSIZE (1 << 16) /* initial heap size (bytes) */
-#define OVERHEAD (sizeof(header_t) + sizeof(footer_t)) /* overhead of the header 
-and footer of an allocated block */
-#define MIN_BLOCK_SIZE (32) /* the minimum block size needed to keep in a freelist 
-(header + footer + next pointer + prev pointer) */
+
+#define ALIGN_SHIFT (MM_ALIGNMENT == 16 ? 4 : 3) /* log2 of MM_ALIGNMENT */
+#define ALIGN(size) (((size) + MM_ALIGNMENT - 1) & ~(size_t)(MM_ALIGNMENT - 1)) /* round size up to a multiple of MM_ALIGNMENT */
+#define CHUNKSIZE MM_CHUNKSIZE /* initial heap size (bytes) */
+#define OVERHEAD (sizeof(header_t)) /* overhead of an allocated block, which has only a header */
+#define MIN_BLOCK_SIZE ALIGN(2 * sizeof(header_t) + 2 * sizeof(link_t)) /* the minimum block size needed to keep in a freelist (header + footer + next link + prev link) */
+#define MAX_BLOCK_SIZE ((1U << 30) - MM_ALIGNMENT) /* largest size the 30 bit block_size holds */
+#define PROLOGUE_SIZE ALIGN(sizeof(header_t) + sizeof(footer_t)) /* the prologue is a header and a footer */
+#define SEGMENT_PAD (MM_ALIGNMENT - sizeof(header_t)) /* pad in front of the prologue of a segment */
+#define SEGMENT_OVERHEAD (SEGMENT_PAD + PROLOGUE_SIZE + sizeof(header_t)) /* bytes of a segment outside its blocks */
+#define SL_SHIFT MM_SL_SHIFT /* log2 of the number of second level classes per first level class */
+#define SL_COUNT (1 << SL_SHIFT) /* second level classes per first level class */
+#define FL_SHIFT (SL_SHIFT + 3) /* sizes below 1 << FL_SHIFT are split linearly in steps of 8 */
+#define FL_COUNT (31 - FL_SHIFT) /* first level classes, enough for a 30 bit block_size */
+#define NUM_CLASSES (FL_COUNT * SL_COUNT) /* number of segregated free lists */
+#define TREE_CLASS (MM_TREE_THRESHOLD ? (__builtin_ctz(MM_TREE_THRESHOLD + !MM_TREE_THRESHOLD) - FL_SHIFT + 1) * SL_COUNT : NUM_CLASSES) /* class of MM_TREE_THRESHOLD, its bitmap bit stands for the tree */
+#define TCACHE_MAX_SIZE ALIGN(512 + OVERHEAD) /* largest block size kept in a thread cache */
+#define TCACHE_BINS (SLAB_CLASSES + ((TCACHE_MAX_SIZE - MIN_BLOCK_SIZE) >> ALIGN_SHIFT) + 1) /* one bin per slab class and per block size */
+#define TCACHE_BIN(asize) (SLAB_CLASSES + (((asize) - MIN_BLOCK_SIZE) >> ALIGN_SHIFT)) /* bin of blocks of asize bytes */
+#define TCACHE_COUNT (16) /* most objects a bin may hold */
+#define TCACHE_BATCH (8) /* objects moved between a bin and the heap at once */
+#define QUICK_MAX_SIZE ALIGN(512 + OVERHEAD) /* largest block size kept on a quick list */
+#define QUICK_LISTS (((QUICK_MAX_SIZE - MIN_BLOCK_SIZE) >> ALIGN_SHIFT) + 1) /* one quick list per block size */
+#define QUICK_LIST(asize) (((asize) - MIN_BLOCK_SIZE) >> ALIGN_SHIFT) /* quick list of blocks of asize bytes */
+#define QUICK_COUNT (64) /* most blocks a quick list holds before the arena is swept */
+#define ARENA_GRANULE_SHIFT (16) /* log2 of the unit arenas take from mem_sbrk, the initial heap of CHUNKSIZE is one unit */
+#define ARENA_GRANULE (1 << ARENA_GRANULE_SHIFT) /* each granule of the heap belongs to one arena */
+#define ARENA_MAP_SIZE (MAX_HEAP / ARENA_GRANULE + 1) /* granules in the largest heap */
+#define ARENA_NONE (0xff) /* arena_map entry of a granule no arena owns, beyond the heap or not yet recorded */
+#define MAP_HEADER_SIZE ALIGN(2 * sizeof(size_t)) /* a mapped region starts with its size and its tag, its payload follows */
+#define MAP_TAG ((size_t)0x6d6d6170) /* the tag of a region is its address xor this */
+#define TRIM_UNIT (MM_ARENAS > 1 ? ARENA_GRANULE : (1 << 12)) /* the top of the heap is trimmed to a multiple of this from heap_base */
+#define TRIM_PAD_MAX (1 << 26) /* most bytes trim_pad grows to */
+#define GROW_BURST (16) /* an arena growing again within this many heap_fit calls doubles its step */
+#define GROW_HEAP_SHARE (16) /* the step is at most this fraction of the heap */
+#define GROW_MAX_STEP (1 << 24) /* and never more than this many bytes */
+#define SLAB_MAX_SIZE (64) /* largest request served from a slab run */
+#define SLAB_CLASSES (SLAB_MAX_SIZE >> ALIGN_SHIFT) /* one slab class per multiple of MM_ALIGNMENT bytes */
+#define SLAB_CLASS(size) (((size) - 1) >> ALIGN_SHIFT) /* slab class of a request of size bytes */
+#define SLAB_OBJ_SIZE(cls) (((cls) + 1) << ALIGN_SHIFT) /* bytes in each object of slab class cls */
+#define RUN_SHIFT (12) /* log2 of the size of a run */
+#define RUN_SIZE (1 << RUN_SHIFT) /* runs start at multiples of RUN_SIZE from heap_base */
+#define RUN_MAP_WORDS (RUN_SIZE / 8 / 64) /* words of the free bitmap of a run, enough for 8 byte objects */
+#define RUN_MAP_SIZE (MAX_HEAP / RUN_SIZE / 64 + 1) /* words of run_map for the largest heap */
+#define CHECK_WINDOW (64) /* blocks mm_checkheap_step cross-checks at once, one bit of a word each */
+
+/* A slab run: this header followed by objects of one size, which have no header or footer */
+typedef struct run_t {
+    struct run_t *next; /* next run of the class with a free object */
+    struct run_t *prev;
+    struct arena_t *arena; /* arena whose lock guards the run */
+    uint16_t obj_size; /* bytes in each object */
+    uint16_t obj_count; /* objects in the run */
+    uint16_t free_count; /* objects not handed out */
+    uint64_t free_map[RUN_MAP_WORDS]; /* bit i set iff object i is free */
+} run_t;
+
+#define RUN_HEADER_SIZE ALIGN(sizeof(run_t)) /* the objects of a run start this far into it */
+#define RUN_BLOCK_SIZE (2 * RUN_SIZE + MIN_BLOCK_SIZE) /* block allocated to place a run, room to line it up on a page */
+#define RUN_OBJ_COUNT(obj_size) ((RUN_SIZE - sizeof(header_t) - RUN_HEADER_SIZE) / (obj_size)) /* the last word of a run is the header of the next block */
+
+/* An arena: an independent heap made of one or more segments, with its own free lists */
+typedef struct arena_t {
+#if MM_THREADS
+    pthread_mutex_t lock;
+    unsigned long lock_waits; /* times a thread found the lock taken, for mm_stats */
+#endif
+    block_t *epilogue; /* epilogue of the segment the arena grew last, NULL if it has none */
+    block_t *free_lists[NUM_CLASSES]; /* heads of the segregated free lists */
+    uint32_t fl_bitmap; /* bit i set iff sl_bitmap[i] is not 0 */
+    uint32_t sl_bitmap[FL_COUNT]; /* bit j of entry i set iff free list i*SL_COUNT+j is not empty */
+    run_t *runs[SLAB_CLASSES]; /* doubly linked runs of each slab class with a free object */
+    char *runs_end; /* end of the highest run the arena made, mm_init clears run_map up to it */
+    uint32_t grow_step; /* least number of bytes the arena grows by, see grow_size */
+    uint32_t fits; /* heap_fit calls since the arena last grew */
+    block_t *rover; /* where MM_NEXT_FIT resumes the search of a class, NULL for its head */
+#if MM_TREE_THRESHOLD
+    block_t *tree; /* root of the treap of free blocks of at least MM_TREE_THRESHOLD bytes */
+#endif
+#if MM_DEFER_COALESCE
+    block_t *quick[QUICK_LISTS]; /* freed blocks of each size linked through their payload, still marked allocated */
+    uint16_t quick_counts[QUICK_LISTS]; /* blocks on each quick list */
+#endif
+} arena_t;
+
+/* Add n to a counter of mm_stats, which threads bump without holding a lock */
+#if MM_STATS && MM_THREADS
+#define STAT_ADD(counter, n) __atomic_fetch_add(&counters.counter, (n), __ATOMIC_RELAXED)
+#elif MM_STATS
+#define STAT_ADD(counter, n) (counters.counter += (n))
+#else
+#define STAT_ADD(counter, n)
+#endif
+
+/* Check the whole heap after every call that changes it, with MM_CHECK 2 */
+#if MM_CHECK >= 2
+#define CHECK_HEAP() mm_checkheap(0)
+#else
+#define CHECK_HEAP()
+#endif
+
+/* Helpers on the malloc and free paths, which MM_INLINE forces inline */
+#if MM_INLINE
+#define HOT static inline __attribute__((always_inline))
+#else
+#define HOT static
+#endif
+
+#if MM_THREADS
+#define LOCK_ARENA(arena) lock_arena(arena)
+#define UNLOCK_ARENA(arena) pthread_mutex_unlock(&(arena)->lock)
+#else
+#define LOCK_ARENA(arena)
+#define UNLOCK_ARENA(arena)
+#endif
+
 /* Global variables */
+static char *heap_base; /* first byte of the heap */
 static block_t *prologue; /* pointer to first block */
-static block_t *epilogue_global; /* pointer to epilogue */
+static arena_t arenas[MM_ARENAS]; /* arenas[0] owns the initial heap */
+static int num_arenas; /* arenas in use, at most MM_ARENAS */
+static int placement = MM_PLACEMENT; /* placement policy of find_fit */
+static int placement_scan = 1; /* large enough blocks MM_GOOD_FIT compares in the class of a request, 0 all */
+#if MM_TRIM_THRESHOLD
+static size_t trim_pad = MM_TRIM_PAD; /* bytes a trimmed block at the top of the heap keeps, kept across mm_init */
+static size_t trim_given; /* bytes the last trim at the top of the heap gave back, until the heap grows again */
+#endif
+#if MM_STATS
+static mm_stats_t counters; /* counters of mm_stats since mm_init, the free list figures stay 0 */
+#endif
+
+#if MM_ARENAS > 1
+static uint8_t arena_map[ARENA_MAP_SIZE]; /* owning arena of each granule of the heap */
+static int next_arena; /* round robin counter handing arenas to new threads */
+static __thread int thread_arena = -1; /* arena of the calling thread, -1 until its first malloc */
+#endif
+#if MM_THREADS
+static pthread_once_t arena_locks_once = PTHREAD_ONCE_INIT;
+#endif
+#if MM_SLAB
+static uint64_t run_map[RUN_MAP_SIZE]; /* bit i set iff the i-th RUN_SIZE page of the heap is slab memory */
+#endif
+static block_t *check_cursor; /* block mm_checkheap_step goes on from, NULL for the prologue */
+#if MM_CHECK_EVERY
+#if MM_THREADS
+static __thread unsigned check_countdown; /* mallocs of the calling thread until it checks the heap */
+#else
+static unsigned check_countdown;
+#endif
+#endif
+
+#if MM_TCACHE
+/*
+ * A thread cache of payloads linked through their first word. Bin i below SLAB_CLASSES
+ * holds slab objects of class i, bin TCACHE_BIN(asize) blocks of exactly asize bytes.
+ */
+typedef struct {
+    uint32_t epoch; /* heap_epoch at the time the cached objects were handed out */
+    uint16_t counts[TCACHE_BINS];
+    void *bins[TCACHE_BINS];
+} tcache_t;
+
+static uint32_t heap_epoch; /* bumped by mm_init, so caches of an old heap get dropped */
+static __thread tcache_t tcache;
+static pthread_once_t tcache_key_once = PTHREAD_ONCE_INIT;
+static pthread_key_t tcache_key; /* only used to flush the cache when its thread exits */
+#endif
+
 /* function prototypes for internal helper routines */
-static block_t *extend_heap(size_t words);
-static block_t *place(block_t *block, size_t asize);
-static block_t *find_fit(size_t asize);
-static block_t *coalesce(block_t *block);
-static footer_t *get_footer(block_t *block);
+HOT arena_t *current_arena(void);
+HOT arena_t *arena_of(block_t *block);
+static inline void *count_malloc(size_t size, void *payload);
+static size_t carve_blocks(block_t *block, size_t asize, size_t n, void **out);
+static int compare_payloads(const void *a, const void *b);
+#if MM_CHECK
+static bool valid_payload(void *payload);
+#endif
+static int stats_class(size_t size);
+HOT block_t *heap_malloc(arena_t *arena, size_t asize);
+static block_t *heap_fit(arena_t *arena, size_t asize);
+static size_t grow_size(arena_t *arena, size_t asize);
+static block_t *heap_realloc(arena_t *arena, block_t *block, size_t asize);
+static void shrink_block(arena_t *arena, block_t *block, size_t asize);
+HOT uint32_t adjust_size(size_t size);
+static void heap_free(arena_t *arena, block_t *block);
+#if MM_TRIM_THRESHOLD
+static void trim_block(arena_t *arena, block_t *block, char *lo, char *hi);
+#endif
+#if MM_DEFER_COALESCE
+static void quick_free(arena_t *arena, block_t *block);
+static bool sweep_quick(arena_t *arena);
+#endif
+#if MM_MMAP_THRESHOLD
+static inline bool is_mapped(void *payload);
+static bool is_region(void *payload);
+static size_t map_size(size_t size);
+static void *map_malloc(size_t size);
+static void *map_realloc(void *payload, size_t size);
+static void map_free(void *payload);
+#endif
+static void set_arena_map(char *start, size_t len, int owner);
+static block_t *extend_heap(arena_t *arena, size_t words);
+static block_t *init_segment(arena_t *arena, void *start, size_t size);
+HOT block_t *place(arena_t *arena, block_t *block, size_t asize);
+HOT block_t *find_fit(arena_t *arena, size_t asize);
+HOT block_t *scan_fit(block_t *block, block_t *end, size_t asize, int scan);
+HOT block_t *larger_fit(arena_t *arena, int cls);
+static block_t *coalesce(arena_t *arena, block_t *block);
+HOT int size_class(size_t size);
+HOT int find_nonempty_class(arena_t *arena, int cls);
+HOT void insert_free_block(arena_t *arena, block_t *block);
+HOT void remove_free_block(arena_t *arena, block_t *block);
+#if MM_TREE_THRESHOLD
+static block_t *tree_fit(arena_t *arena, size_t asize);
+static void tree_insert(arena_t *arena, block_t *block);
+static void tree_remove(arena_t *arena, block_t *block);
+static void tree_rotate_up(arena_t *arena, block_t *block);
+static block_t *tree_next(block_t *block);
+static inline bool tree_less(block_t *a, block_t *b);
+static inline uint32_t tree_priority(block_t *block);
+static inline block_t *tree_child(block_t *block, int side);
+static inline block_t *tree_parent(block_t *block);
+static inline void set_tree_child(block_t *block, int side, block_t *child);
+static inline void set_tree_parent(block_t *block, block_t *parent);
+static int checktree(arena_t *arena, int index);
+#endif
+static inline block_t *next_free(block_t *block);
+static inline block_t *prev_free(block_t *block);
+static inline void set_next_free(block_t *block, block_t *next);
+static inline void set_prev_free(block_t *block, block_t *prev);
+HOT footer_t *get_footer(block_t *block);
 static void printblock(block_t *block);
 static void checkblock(block_t *block);
+static int checkfree(arena_t *arena, block_t *block, block_t **links, int *num_links);
+static int window_index(block_t **window, int n, block_t *block);
+static inline bool in_heap(void *ptr);
+static inline void merge_cursor(block_t *block, block_t *into);
+#if MM_SLAB
+static inline bool is_slab(void *payload);
+static inline run_t *run_of(void *payload);
+static void *slab_malloc(arena_t *arena, int cls);
+static void slab_free(run_t *run, void *payload);
+static run_t *new_run(arena_t *arena, int cls);
+static void unlink_run(run_t *run);
+static int checkrun(run_t *run, bool verbose);
+#endif
+#if MM_TCACHE
+static void heap_free_list(void *list);
+static void tcache_reset(void);
+static void *tcache_take(arena_t *arena, int bin);
+static void *tcache_malloc(int bin);
+static void tcache_free(void *payload, int bin);
+static void tcache_flush(void *cache);
+static void tcache_make_key(void);
+#endif
+#if MM_THREADS
+static inline void lock_arena(arena_t *arena);
+static void init_arena_locks(void);
+static void lock_arenas(void);
+static void unlock_arenas(void);
+static void init_arenas_after_fork(void);
+#endif
+
 /*
  * mm_init - Initialize the memory manager: prologue, epilogue and first free block
- Prologue is the start of the memory heap but also the start of the free list. It 
-has two pointers: prev and next that 
- point to previous and next blocks respectively. Prologue points to the first free 
-block on the list (prev points to null).
- Epilogue is the end of the free list but also the end of the memory heap. It also 
-has two pointers: prev and next.
+ Every arena is emptied, then the initial heap becomes the first segment of arena 0.
+ The other arenas get their first segment when a thread first allocates from them.
  Initial structure of the heap:
- Prologue -> init_block -> Epilogue
+ Prologue | init_block | Epilogue
  */
 /* $begin mminit */
 int mm_init(void) {
+#if MM_TCACHE
+    heap_epoch++;
+#endif
+#if MM_STATS
+    memset(&counters, 0, sizeof(counters));
+#endif
+#if MM_THREADS
+    pthread_once(&arena_locks_once, init_arena_locks);
+    num_arenas = sysconf(_SC_NPROCESSORS_ONLN);
+    if (num_arenas < 1)
+        num_arenas = 1;
+    if (num_arenas > MM_ARENAS)
+        num_arenas = MM_ARENAS;
+#else
+    num_arenas = 1;
+#endif
+#if MM_SLAB
+    /* forget the runs of a previous heap */
+    size_t run_words = 0;
+    for (int i = 0; i < MM_ARENAS; i++) {
+        if (arenas[i].runs_end != NULL && ((arenas[i].runs_end - heap_base) >> RUN_SHIFT) / 64 + 1 > run_words)
+            run_words = ((arenas[i].runs_end - heap_base) >> RUN_SHIFT) / 64 + 1;
+    }
+    memset(run_map, 0, run_words * sizeof(run_map[0]));
+#endif
+    check_cursor = NULL;
+    /* reset the free lists left over from a previous heap */
+    for (int i = 0; i < MM_ARENAS; i++) {
+        arenas[i].epilogue = NULL;
+        memset(arenas[i].runs, 0, sizeof(arenas[i].runs));
+        arenas[i].runs_end = NULL;
+        memset(arenas[i].free_lists, 0, sizeof(arenas[i].free_lists));
+        memset(arenas[i].sl_bitmap, 0, sizeof(arenas[i].sl_bitmap));
+        arenas[i].fl_bitmap = 0;
+        arenas[i].grow_step = CHUNKSIZE;
+        arenas[i].fits = 0;
+        arenas[i].rover = NULL;
+#if MM_TREE_THRESHOLD
+        arenas[i].tree = NULL;
+#endif
+#if MM_THREADS
+        arenas[i].lock_waits = 0;
+#endif
+#if MM_DEFER_COALESCE
+        memset(arenas[i].quick, 0, sizeof(arenas[i].quick));
+        memset(arenas[i].quick_counts, 0, sizeof(arenas[i].quick_counts));
+#endif
+    }
     /* create the initial empty heap */
-    if ((prologue = mem_sbrk(CHUNKSIZE)) == (void*)-1)
+    if ((heap_base = mem_sbrk(CHUNKSIZE)) == (void*)-1)
         return -1;
-    /* initialize the prologue */
-    prologue->allocated = ALLOC;
-    prologue->block_size = sizeof(block_t);
-    /* initialize the first free block */
-    block_t *init_block = (void *)prologue + sizeof(block_t);
-    init_block->allocated = FREE;
-    init_block->block_size = CHUNKSIZE - OVERHEAD - 32; //prologue and epilogue 
-have two pointers each
-    footer_t *init_footer = get_footer(init_block);
-    init_footer->allocated = FREE;
-    init_footer->block_size = init_block->block_size;
-    /* initialize the epilogue - block size 0 will be used as a terminating 
-condition */
-    block_t *epilogue = (void *)init_block + init_block->block_size;
-    epilogue->allocated = ALLOC;
-    epilogue->block_size = 0;
-    prologue->body.prev = NULL;
-    prologue->body.next = init_block;//add to free list
-    init_block->body.next = epilogue; //end of freelist
-    init_block->body.prev = prologue; //add to free list
-    epilogue->body.prev = init_block;
-    epilogue->body.next = NULL;
-    epilogue_global = epilogue;
+    prologue = (void *)heap_base + SEGMENT_PAD;
+#if MM_ARENAS > 1
+    memset(arena_map, ARENA_NONE, sizeof(arena_map));
+    arena_map[0] = 0;
+#endif
+    insert_free_block(&arenas[0], init_segment(&arenas[0], heap_base, CHUNKSIZE));
     return 0;
 }
 /* $end mminit */
+
 /*
  * mm_malloc - Allocate a block with at least size bytes of payload
- mm_malloc recieves the size of the payload and adds the size of header, footer to 
-it and aligns it to nearest multiple of 8.
- It searches find_fit for a free block and calls place function accordingly. If 
-free block is not available (find_fit returns null), 
- it extends heap and calls find_fit again.
+ Requests of up to SLAB_MAX_SIZE bytes get an object of a slab run, requests of at least
+ MM_MMAP_THRESHOLD bytes a mapped region.
+ Otherwise mm_malloc recieves the size of the payload and adds the size of the header to it and aligns it to nearest multiple of MM_ALIGNMENT.
+ Slab objects and small blocks come from the thread cache when there is one, everything
+ else from the arena of the calling thread under the arena lock.
  mm_malloc returns pointer to the start of payload
  */
 /* $begin mmmalloc */
 void *mm_malloc(size_t size) {
-  
+
     uint32_t asize;       /* adjusted block size */
-    uint32_t extendsize;  /* amount to extend heap if no fit */
-    uint32_t extendwords; /* number of words to extend heap if no fit */
     block_t *block;
+
     /* Ignore spurious requests */
     if (size == 0)
         return NULL;
-    /* Adjust block size to include overhead and alignment reqs. */
-    size += OVERHEAD;
-    asize = ((size + 7) >> 3) << 3; /* align to multiple of 8 */
-    
-    if (asize < MIN_BLOCK_SIZE) {
-        asize = MIN_BLOCK_SIZE;
-    }
-    /* Search the free list for a fit */
-    if ((block = find_fit(asize)) != NULL) {
-        block_t* b = place(block, asize);
-        return b->body.payload;
-    }
-    /* No fit found. Get more memory and place the block */
-    extendsize = (asize > CHUNKSIZE) // extend by the larger of the two
-                     ? asize
-                     : 6 * CHUNKSIZE;
-    extendwords = extendsize >> 3; // extendsize/8
-    if ((block = extend_heap(extendwords)) != NULL) {
-        block_t* b = place(block, asize);
-        return b->body.payload;
+#if MM_MMAP_THRESHOLD
+    if (size >= MM_MMAP_THRESHOLD)
+        return count_malloc(size, map_malloc(size));
+#endif
+    /* and ones too large for a block */
+    if (size > MAX_BLOCK_SIZE - OVERHEAD)
+        return NULL;
+
+#if MM_SLAB
+    if (size <= SLAB_MAX_SIZE) {
+        int cls = SLAB_CLASS(size);
+#if MM_TCACHE
+        return count_malloc(size, tcache_malloc(cls));
+#else
+        arena_t *arena = current_arena();
+        LOCK_ARENA(arena);
+        void *payload = slab_malloc(arena, cls);
+        UNLOCK_ARENA(arena);
+        return count_malloc(size, payload);
+#endif
     }
-    /* no more memory :( */
-    return NULL;
+#endif
+
+    asize = adjust_size(size);
+
+#if MM_TCACHE
+    if (asize <= TCACHE_MAX_SIZE)
+        return count_malloc(size, tcache_malloc(TCACHE_BIN(asize)));
+#endif
+    arena_t *arena = current_arena();
+    LOCK_ARENA(arena);
+    block = heap_malloc(arena, asize);
+    UNLOCK_ARENA(arena);
+    return count_malloc(size, (block != NULL) ? block->body.payload : NULL);
 }
 /* $end mmmalloc */
+
 /*
  * mm_free - Free a block
- mm_free frees the block and adds it to the free list according to size.
- If blocksize - OVERHEAD is less than or equal to 100 it places it at the beginning
-of free list: prologue -> freed block ->....
- If blocksize - OVERHEAD is more than 100, it places it at the end of the free 
-list: ... -> freed block -> epilogue
+ mm_free keeps slab objects and small blocks in the thread cache when there is one
+ and otherwise returns them to the run or arena that owns them, whichever thread
+ allocated them. Mapped regions are unmapped. With MM_DEFER_COALESCE small blocks
+ go on a quick list of their arena instead of being coalesced.
  */
 /* $begin mmfree */
 void mm_free(void *payload) {
+    if (payload == NULL)
+        return;
+#if MM_CHECK
+    if (!valid_payload(payload))
+        return;
+#endif
+    STAT_ADD(frees[stats_class(mm_usable_size(payload))], 1);
+#if MM_MMAP_THRESHOLD
+    if (is_mapped(payload)) {
+        map_free(payload);
+        CHECK_HEAP();
+        return;
+    }
+#endif
+#if MM_SLAB
+    if (is_slab(payload)) {
+        run_t *run = run_of(payload);
+#if MM_TCACHE
+        tcache_free(payload, SLAB_CLASS(run->obj_size));
+#else
+        LOCK_ARENA(run->arena);
+        slab_free(run, payload);
+        UNLOCK_ARENA(run->arena);
+#endif
+        CHECK_HEAP();
+        return;
+    }
+#endif
     //finding the start of the block
     block_t *block = payload - sizeof(header_t);
-    block->allocated = FREE;
-    footer_t *footer = get_footer(block);
-    footer->allocated = FREE;
-    //updating pointers
-    if(block->block_size - OVERHEAD <= 100){
-        //adding to start of free list
-        block_t *n = prologue->body.next;
-        prologue->body.next = block;
-        block->body.prev = prologue;
-        block->body.next = n;
-        n->body.prev = block;
-    } else {
-        //adding to end of free list
-        block_t *n = epilogue_global->body.prev;
-        epilogue_global->body.prev = block;
-        block->body.next = epilogue_global;
-        block->body.prev = n;
-        n->body.next = block;
+#if MM_TCACHE
+    if (block->block_size <= TCACHE_MAX_SIZE) {
+        tcache_free(payload, TCACHE_BIN(block->block_size));
+        CHECK_HEAP();
+        return;
     }
-    coalesce(block);
+#endif
+    arena_t *arena = arena_of(block);
+    LOCK_ARENA(arena);
+#if MM_DEFER_COALESCE
+    if (block->block_size <= QUICK_MAX_SIZE)
+        quick_free(arena, block);
+    else
+#endif
+        heap_free(arena, block);
+    UNLOCK_ARENA(arena);
+    CHECK_HEAP();
 }
 /* $end mmfree */
+
 /*
- * mm_realloc - naive implementation of mm_realloc
- * NO NEED TO CHANGE THIS CODE!
+ * mm_malloc_bulk - Allocate n payloads of size bytes each, store them in out
+ Returns how many were allocated, less than n only when memory ran out.
+ The payloads come from the arena of the calling thread under a single acquisition
+ of its lock, bypassing the thread cache. Slab objects and mapped regions are taken
+ one by one. Blocks are cut from one free block holding as many of them as a block
+ can: the free lists are searched and split once per such block, which carve_blocks
+ then cuts into adjacent pieces in one pass. When no free block holds them all,
+ fewer are asked for at a time, and only a single block grows the heap.
  */
-void *mm_realloc(void *ptr, size_t size) {
-    void *newp;
-    size_t copySize;
-    if ((newp = mm_malloc(size)) == NULL) {
-        printf("ERROR: mm_malloc failed in mm_realloc\n");
-        exit(1);
+size_t mm_malloc_bulk(size_t size, size_t n, void **out) {
+    size_t done = 0;
+
+    if (size == 0)
+        return 0;
+#if MM_MMAP_THRESHOLD
+    if (size >= MM_MMAP_THRESHOLD) {
+        while (done < n && (out[done] = count_malloc(size, map_malloc(size))) != NULL)
+            done++;
+        return done;
     }
-    block_t* block = ptr - sizeof(header_t);
-    copySize = block->block_size;
-    if (size < copySize)
-        copySize = size;
-    memcpy(newp, ptr, copySize);
-    mm_free(ptr);
-    return newp;
+#endif
+    if (size > MAX_BLOCK_SIZE - OVERHEAD)
+        return 0;
+
+    arena_t *arena = current_arena();
+    LOCK_ARENA(arena);
+#if MM_SLAB
+    if (size <= SLAB_MAX_SIZE) {
+        while (done < n && (out[done] = slab_malloc(arena, SLAB_CLASS(size))) != NULL)
+            done++;
+    } else
+#endif
+    {
+        uint32_t asize = adjust_size(size);
+        size_t count = MAX_BLOCK_SIZE / asize;
+        while (done < n) {
+            block_t *block;
+            if (count > n - done)
+                count = n - done;
+            if ((block = find_fit(arena, asize * count)) == NULL) {
+                if (count > 1) {
+                    count /= 2;
+                    continue;
+                }
+                if ((block = heap_fit(arena, asize)) == NULL)
+                    break;
+                /* the heap grew, the free block it ends with may hold the rest */
+                out[done++] = place(arena, block, asize)->body.payload;
+                count = MAX_BLOCK_SIZE / asize;
+                continue;
+            }
+            done += carve_blocks(place(arena, block, asize * count), asize, count, out + done);
+        }
+    }
+    UNLOCK_ARENA(arena);
+    for (size_t i = 0; i < done; i++)
+        count_malloc(size, out[i]);
+    return done;
 }
+
 /*
- * mm_checkheap - Check the heap for consistency
- Prints prologue, and checks if it it's size of blocksize and if it allocated.
- Traverses the entire heap and prints out all the blocks.
- Prints epilogue and checks if it's size if zero and if it is allocated.
+ * carve_blocks - Cut an allocated block into n adjacent blocks of asize bytes, the last
+ keeping any splinter place left on it, and store their payloads in out. Returns n.
  */
-void mm_checkheap(int verbose) {
-    block_t *block = prologue;
-    if (verbose)
-        printf("Heap (%p):\n", prologue);
-    if (block->block_size != sizeof(block_t) || !block->allocated)
-        printf("Bad prologue header\n");
-    checkblock(prologue);
-    /* iterate through the heap (both free and allocated blocks will be present) */
-    for (block = (void*)prologue+prologue->block_size; block->block_size > 0; block
-= (void *)block + block->block_size) {
-        if (verbose)
-            printblock(block);
-        checkblock(block);
+static size_t carve_blocks(block_t *block, size_t asize, size_t n, void **out) {
+    STAT_ADD(splits, n - 1);
+    for (size_t i = 0; i + 1 < n; i++) {
+        size_t rest_size = block->block_size - asize;
+        out[i] = block->body.payload;
+        block->block_size = asize;
+        block = (void *)block + asize;
+        block->allocated = ALLOC;
+        block->prev_allocated = ALLOC;
+        block->block_size = rest_size;
     }
-    if (verbose)
-        printblock(block);
-    if (block->block_size != 0 || !block->allocated)
-        printf("Bad epilogue header\n");
+    out[n - 1] = block->body.payload;
+    return n;
 }
-/* The remaining routines are internal helper routines */
+
 /*
- * extend_heap - Extend heap with free block and return its block pointer 
- Make the old epilogue head of new free block and coalesce
- Find new epilogue which is at the end of the heap 
- Update pointers of new free blcok to point to new epilogue 
+ * mm_free_bulk - Free the n payloads of ptrs, which may hold NULLs and is sorted in place
+ Sorted by address, blocks lying next to each other follow each other in ptrs. Each
+ such run is merged into one block, as large as a block can be, that is coalesced
+ with its neighbours and put on a free list once. The lock of an arena is held across
+ the payloads it owns, which go straight back to their arena or slab run, bypassing
+ the thread cache and the quick lists. Mapped regions are unmapped one by one.
  */
-/* $begin mmextendheap */
-static block_t *extend_heap(size_t words) {
-    //if (debug_mode) printf("extend_heap: %i\n", words);
-    block_t *block;
-    uint32_t size;
-    size = words << 3; // words*8
-    if (size == 0 || (block = mem_sbrk(size)) == (void *)-1)
-        return NULL;
-    /* The newly acquired region will start directly after the epilogue block */ 
-    /* Initialize free block header/footer and the new epilogue header */
-    /* use old epilogue as new free block header */
-    block = (void *)block - sizeof(block_t);
-    block->allocated = FREE;
-    block->block_size = size;
-    /* free block footer */
-    footer_t *block_footer = get_footer(block);
-    block_footer->allocated = FREE;
-    block_footer->block_size = block->block_size;
-    /* new epilogue header */
-    block_t *new_epilogue = (void *)block_footer + sizeof(header_t);
-    new_epilogue->allocated = ALLOC;
-    new_epilogue->block_size = 0;
-    //update pointers
-    block->body.next = new_epilogue;
-    new_epilogue->body.prev = block;
-    new_epilogue->body.next = NULL;
-    epilogue_global = new_epilogue;
-    /* Coalesce if the previous block was free */
-    return coalesce(block);
+void mm_free_bulk(void **ptrs, size_t n) {
+    arena_t *locked = NULL;
+    size_t i = 0;
+
+    qsort(ptrs, n, sizeof(void *), compare_payloads);
+    while (i < n) {
+        void *payload = ptrs[i++];
+        if (payload == NULL)
+            continue;
+#if MM_CHECK
+        if (!valid_payload(payload))
+            continue;
+#endif
+        STAT_ADD(frees[stats_class(mm_usable_size(payload))], 1);
+#if MM_MMAP_THRESHOLD
+        if (is_mapped(payload)) {
+            map_free(payload);
+            continue;
+        }
+#endif
+        block_t *block = payload - sizeof(header_t);
+#if MM_SLAB
+        run_t *run = is_slab(payload) ? run_of(payload) : NULL;
+        arena_t *arena = (run != NULL) ? run->arena : arena_of(block);
+#else
+        arena_t *arena = arena_of(block);
+#endif
+        if (arena != locked) {
+            if (locked != NULL)
+                UNLOCK_ARENA(locked);
+            LOCK_ARENA(arena);
+            locked = arena;
+        }
+#if MM_SLAB
+        if (run != NULL) {
+            slab_free(run, payload);
+            continue;
+        }
+#endif
+        /* absorb the allocated blocks right after it that are freed too */
+        block_t *next = (void *)block + block->block_size;
+        while (i < n && ptrs[i] == next->body.payload && next->allocated &&
+               block->block_size + next->block_size <= MAX_BLOCK_SIZE) {
+            STAT_ADD(frees[stats_class(next->block_size - OVERHEAD)], 1);
+            merge_cursor(next, block);
+            block->block_size += next->block_size;
+            next = (void *)block + block->block_size;
+            i++;
+        }
+        heap_free(arena, block);
+    }
+    if (locked != NULL)
+        UNLOCK_ARENA(locked);
+    CHECK_HEAP();
 }
-/* $end mmextendheap */
+
 /*
- * place - 
- Case 1: Leftover space in block after allocating block is greater than or equal to
-Minimum Block size
-    Case 1a: Payload is less than or equal to 100
-        Split the block according to block size such that the first part of free 
-block is allocated and the second part is free.
-        This way all the smaller block will be at the beginning of the heap.
-        Update pointers to include new smaller free block in free list.
-    Case 1b: Payload is greater than 100
-        Split the block such that the latter part (the latter block_size bytes of 
-free block are marked as allocated).
-        All larger blocks are placed towards the end of the heap.
-        Update pointers to include new larger free block to the free list.
- Case 2: Leftover psace in block is smaller than Minimum block size
-    Mark block as allocated
-    Update pointers of previous block and next bloxk to point to each other
+ * compare_payloads - Order payloads by address for qsort
  */
-/* $begin mmplace */
-static block_t *place(block_t *block, size_t asize) {
-    size_t split_size = block->block_size - asize;
-    if (split_size >= MIN_BLOCK_SIZE) {
-        if (asize - OVERHEAD <= 100) {
-            /* split the block by updating the header and marking it allocated*/
-            block->block_size = asize;
-            block->allocated = ALLOC;
-            /* set footer of allocated block*/
-            footer_t *footer = get_footer(block);
-            footer->block_size = asize;
-            footer->allocated = ALLOC;
-            /* update the header of the new free block */
-            block_t *new_block = (void *)block + block->block_size;
-            new_block->block_size = split_size;
-            new_block->allocated = FREE;
-            /* update the footer of the new free block */
-            footer_t *new_footer = get_footer(new_block);
-            new_footer->block_size = split_size;
-            new_footer->allocated = FREE;
-            //update pointers to point to new smaller free block
-            block_t *p = block->body.prev;
-            block_t *t = block->body.next;
-            new_block->body.prev = p;
-            new_block->body.next = t;
-            p->body.next = new_block;
-            t->body.prev = new_block;
-            return block;
-        } else {
-            //find footer of free block
-            footer_t *footer = get_footer(block); //update footer
-            footer->block_size = asize;
-            footer->allocated = ALLOC;
-            //find header of this new block with updated size thats at the end of 
-the free block
-            block_t *b = (void*)footer - footer->block_size + sizeof(header_t); 
-            b->block_size = asize; //update header
-            b->allocated = ALLOC;
-            
-            //creating new block at the beginning
-            block->block_size = split_size;
-            block->allocated = FREE; //already marked free 
-            footer = get_footer(block);
-            footer->block_size = split_size;
-            footer->allocated = FREE;
-            //make pointers point to new block
-            //prev and next pointer already points to correct place
-            return b;
-        }
-    } else {
-        /* splitting the block will cause a splinter so we just include it in the 
-allocated block */
-        block->allocated = ALLOC;
-        footer_t *footer = get_footer(block);
-        footer->allocated = ALLOC;
-        //updating pointers to make the previous and next free block to point to 
-each other
-        block_t *p = block->body.prev;
-        block_t *t = block->body.next;
-        p->body.next = t;
-        t->body.prev = p;
-        return block;
+static int compare_payloads(const void *a, const void *b) {
+    uintptr_t x = (uintptr_t)*(void *const *)a, y = (uintptr_t)*(void *const *)b;
+    return (x > y) - (x < y);
+}
+
+/*
+ * count_malloc - Count a request of size bytes for mm_stats if it got a payload, return the payload
+ Every request ends here, so with MM_CHECK 2 the heap is checked here too, and with
+ MM_CHECK_EVERY a step of mm_checkheap_step is taken every MM_CHECK_EVERY requests.
+ */
+static inline void *count_malloc(size_t size, void *payload) {
+    CHECK_HEAP();
+#if MM_CHECK_EVERY
+    if (check_countdown-- == 0) {
+        check_countdown = MM_CHECK_EVERY - 1;
+        mm_checkheap_step(MM_CHECK_BLOCKS);
+    }
+#endif
+#if MM_STATS
+    if (payload != NULL) {
+        STAT_ADD(mallocs[stats_class(size)], 1);
+        STAT_ADD(requested, size);
+        STAT_ADD(granted, mm_usable_size(payload));
     }
+#endif
+    return payload;
 }
-/* $end mmplace */
+
+#if MM_CHECK
 /*
- * find_fit - Find a fit for a block with asize bytes
- Case 1: payload is less than or equal to 100 
-    Start searching from the beginning of the free list 
-Case 2: payload is greater than 100
-    Start searching from end of free list
- */
-static block_t *find_fit(size_t asize) {
-    //if (debug_mode) printf("find_fit: %i\n", asize);
-    /* first fit search */
-    block_t *b;
-    if ((asize - OVERHEAD) <= 100) {
-        //searching from beginning
-        for (b = prologue->body.next; b->body.next != NULL /* epilogue */; b = b-
->body.next ) {
-            if (!b->allocated && asize <= b->block_size) {
-                return b;
-            }
+ * valid_payload - Is payload one that mm malloc handed out and that was not freed since?
+ Prints an error and returns false if not, for mm_free and mm_realloc to leave the heap as it is.
+ Case 1: payload is not a multiple of MM_ALIGNMENT, it cannot be a payload
+ Case 2: payload lies outside the heap, which is fine only for a mapped region
+ Case 3: payload is in a slab run, it must start an object whose bit in the free bitmap is clear
+ Case 4: payload is in a block, whose header must be allocated and agree with the prev a/f
+    bit of the block after it
+ Objects held by a thread cache or a quick list still look allocated, so freeing one
+ of them twice goes unnoticed.
+ */
+static bool valid_payload(void *payload) {
+    if ((uintptr_t)payload % MM_ALIGNMENT) { /* Case 1 */
+        printf("Error: %p is not aligned like a payload\n", payload);
+        return false;
+    }
+    if ((char *)payload < heap_base || (char *)payload > (char *)mem_heap_hi()) { /* Case 2 */
+#if MM_MMAP_THRESHOLD
+        if (is_mapped(payload) && is_region(payload))
+            return true;
+#endif
+        printf("Error: %p is not in the heap\n", payload);
+        return false;
+    }
+#if MM_SLAB
+    if (is_slab(payload)) { /* Case 3 */
+        run_t *run = run_of(payload);
+        size_t offset = (char *)payload - (char *)run - RUN_HEADER_SIZE;
+        unsigned index = offset / run->obj_size;
+        if ((char *)payload < (char *)run + RUN_HEADER_SIZE || offset % run->obj_size || index >= run->obj_count) {
+            printf("Error: %p is not an object of slab run %p\n", payload, run);
+            return false;
         }
-    } else {
-        //searching from end
-        for (b = epilogue_global->body.prev; b->body.prev != NULL /* prologue */; b
-= b->body.prev ) {
-            if (!b->allocated && asize <= b->block_size) {
-                return b;
-            }
+        if ((run->free_map[index / 64] >> (index % 64)) & 1) {
+            printf("Error: slab object %p is already free\n", payload);
+            return false;
         }
+        return true;
     }
-    return NULL; /* no fit */
+#endif
+    block_t *block = payload - sizeof(header_t); /* Case 4 */
+    if (!block->allocated) {
+        printf("Error: block %p is already free\n", block);
+        return false;
+    }
+    header_t *next = (void *)block + block->block_size;
+    if (block->block_size < MIN_BLOCK_SIZE || (void *)next > mem_heap_hi() || !next->prev_allocated) {
+        printf("Error: block %p has a bad header\n", block);
+        return false;
+    }
+    return true;
 }
+#endif
+
 /*
- * coalesce - boundary tag coalescing. Return ptr to coalesced block
- The status (free or allocated) of the adjacent blocks are found
- Blocks are coalesced accordingly and pointers are updated.
+ * stats_class - Class of mm_stats a size falls in, the power of two at or above it
  */
-static block_t *coalesce(block_t *block) {
-    footer_t *prev_footer = (void *)block - sizeof(header_t);
-    header_t *next_header = (void *)block + block->block_size;
-    bool prev_alloc = prev_footer->allocated;
-    bool next_alloc = next_header->allocated;
-    //prologue does not have a footer so prev_alloc will be always 1 if this block 
-is the beginning of heap
-    if ((void*)block - 24 == prologue) prev_alloc = 1;
-    if (prev_alloc && next_alloc) { /* Case 1 */
-        /* no coalesceing */
+static int stats_class(size_t size) {
+    int cls = (size > 1) ? 64 - __builtin_clzl(size - 1) : 0;
+    return (cls < MM_STATS_CLASSES) ? cls : MM_STATS_CLASSES - 1;
+}
+
+/*
+ * heap_malloc - Allocate a block of asize bytes from an arena, its lock must be held
+ It gets a free block from heap_fit and calls place function accordingly.
+ With MM_DEFER_COALESCE a block of exactly asize bytes on a quick list comes first.
+ */
+HOT block_t *heap_malloc(arena_t *arena, size_t asize) {
+    block_t *block;
+
+#if MM_DEFER_COALESCE
+    if (asize <= QUICK_MAX_SIZE && (block = arena->quick[QUICK_LIST(asize)]) != NULL) {
+        arena->quick[QUICK_LIST(asize)] = *(block_t **)block->body.payload;
+        arena->quick_counts[QUICK_LIST(asize)]--;
         return block;
     }
-    else if (prev_alloc && !next_alloc) { /* Case 2 */
-        /* Update header of current block to include next block's size */
-        block->block_size += next_header->block_size;
-        /* Update footer of next block to reflect new size */
-        footer_t *next_footer = get_footer(block);
-        next_footer->block_size = block->block_size;
-        //casting
-        block_t *next_block = (void*)next_header;
-        //updating pointers
-        //making blocks pointed to by previous and next pointers of block point to 
-each other (*block is already part of free list)
-        block_t *p = next_block->body.prev; 
-        block_t *t = next_block->body.next;
-        p->body.next = t;
-        t->body.prev = p;
-    }
-    else if (!prev_alloc && next_alloc) { /* Case 3 */
-        /* Update header of prev block to include current block's size */
-        block_t *prev_block = (void *)prev_footer - prev_footer->block_size + 
-sizeof(header_t);
-        prev_block->block_size += block->block_size;
-        /* Update footer of current block to reflect new size */
-        footer_t *footer = get_footer(prev_block);
-        footer->block_size = prev_block->block_size;
-        //updating pointers 
-        //making the free blocks pointed to by prev_block next and previous 
-pointers point to each other
-        block_t *p = block->body.prev;
-        block_t *t = block->body.next;
-        p->body.next = t;
-        t->body.prev = p;
-        block = prev_block;
+#endif
+
+    if ((block = heap_fit(arena, asize)) != NULL) {
+        return place(arena, block, asize);
     }
-    else { /* Case 4 */
-        /* Update header of prev block to include current and next block's size */
-        block_t *prev_block = (void *)prev_footer - prev_footer->block_size + 
-sizeof(header_t);
-        prev_block->block_size += block->block_size + next_header->block_size;
-        /* Update footer of next block to reflect new size */
-        footer_t *next_footer = get_footer(prev_block);
-        next_footer->block_size = prev_block->block_size;
-        
-        //casting 
-        block_t *next_block = (void*)next_header;
-        //making the free blocks pointed to by block next and previous pointers 
-point to each other
-        block_t *p = block->body.prev;
-        block_t *t = block->body.next;
-        p->body.next = t;
-        t->body.prev = p;
-        //making the free blocks pointed to by next_block next and previous 
-pointers point to each other
-        block_t *p1 = next_block->body.prev; 
-        block_t *t1 = next_block->body.next;
-        p1->body.next = t1;
-        t1->body.prev = p1;
-        block = prev_block;
+    /* no more memory :( */
+    return NULL;
+}
+
+/*
+ * heap_fit - Find a free block of at least asize bytes in an arena, its lock must be held
+ It searches find_fit for a free block. If free block is not available (find_fit returns null),
+ it extends heap by grow_size and returns the new free block. The block stays on its free list.
+ With MM_DEFER_COALESCE the quick lists are swept and searched again before the heap grows.
+ When another arena grew the heap in between, the new memory starts a segment of its own and
+ may fall short, so the arena grows once more by enough for a segment holding the block.
+ */
+static block_t *heap_fit(arena_t *arena, size_t asize) {
+    block_t *block;
+
+    arena->fits++;
+    /* Search the free list for a fit */
+    if ((block = find_fit(arena, asize)) != NULL) {
+        return block;
     }
+#if MM_DEFER_COALESCE
+    if (sweep_quick(arena) && (block = find_fit(arena, asize)) != NULL)
+        return block;
+#endif
+
+    /* No fit found. Get more memory */
+    block = extend_heap(arena, grow_size(arena, asize) >> 3);
+    while (block != NULL && block->block_size < asize)
+        block = extend_heap(arena, (asize + SEGMENT_OVERHEAD) >> 3);
     return block;
 }
-//finding footer of the block 
-static footer_t* get_footer(block_t *block) {
-    return (void*)block + block->block_size - sizeof(footer_t);
+
+/*
+ * grow_size - Bytes to extend an arena by when it has no fit for a block of asize bytes
+ What the arena misses is asize less the free block ending its last segment when that
+ segment ends the heap, since the new memory coalesces with it, or otherwise asize and the
+ overhead of a new segment. The arena grows by at least its grow step, which adapts to the
+ rate of allocation: it doubles when the arena grows again within GROW_BURST calls of
+ heap_fit, up to a GROW_HEAP_SHARE of the heap, and halves back towards CHUNKSIZE when
+ the arena grows less often.
+ */
+static size_t grow_size(arena_t *arena, size_t asize) {
+    block_t *epilogue = arena->epilogue;
+    size_t missing = asize + SEGMENT_OVERHEAD;
+    size_t limit = mem_heapsize() / GROW_HEAP_SHARE;
+
+    if (epilogue != NULL && (void *)epilogue + sizeof(header_t) == mem_heap_hi() + 1) {
+        footer_t *last = (void *)epilogue - sizeof(footer_t);
+        missing = epilogue->prev_allocated ? asize : asize - last->block_size;
+        /* the new free block must be able to hold its free list links until it is coalesced */
+        if (missing < MIN_BLOCK_SIZE)
+            missing = MIN_BLOCK_SIZE;
+    }
+    if (arena->fits <= GROW_BURST) {
+        if (arena->grow_step < GROW_MAX_STEP && arena->grow_step < limit)
+            arena->grow_step *= 2;
+    } else if (arena->grow_step > CHUNKSIZE) {
+        arena->grow_step /= 2;
+    }
+    arena->fits = 0;
+    return (missing > arena->grow_step) ? missing : arena->grow_step;
 }
-//prints address, header and footer of block
-static void printblock(block_t *block) {
-    uint32_t hsize, halloc, fsize, falloc;
-    hsize = block->block_size;
-    halloc = block->allocated;
+
+/*
+ * heap_free - Return a block to the arena owning it, the arena lock must be held
+ heap_free marks the block as free, gives it back its footer and tells the next block,
+ then hands it to coalesce, which merges it with its free neighbours and inserts the
+ result into the free list of its size class. A result of at least MM_TRIM_THRESHOLD
+ bytes more than trim_pad is trimmed, giving back the pages of the block and of the
+ neighbours it merged with that were too small to be trimmed themselves.
+ */
+static void heap_free(arena_t *arena, block_t *block) {
+#if MM_TRIM_THRESHOLD
+    size_t limit = MM_TRIM_THRESHOLD + __atomic_load_n(&trim_pad, __ATOMIC_RELAXED);
+    char *lo = (char *)block, *hi = (char *)block + block->block_size;
+    footer_t *prev_footer = (void *)block - sizeof(footer_t);
+    header_t *next_header = (void *)hi;
+    if (!block->prev_allocated && prev_footer->block_size < limit)
+        lo -= prev_footer->block_size;
+    if (!next_header->allocated && next_header->block_size < limit)
+        hi += next_header->block_size;
+#endif
+    block->allocated = FREE;
     footer_t *footer = get_footer(block);
-    fsize = footer->block_size;
-    falloc = footer->allocated;
-    if (hsize == 0) {
-        printf("%p: EOL\n", block);
-        return;
-    }
-    printf("%p: header: [%d:%c] footer: [%d:%c] prev: %p next %p\n", block, hsize,
-           (halloc ? 'a' : 'f'), fsize, (falloc ? 'a' : 'f'), block->body.prev, 
-block->body.next);
+    footer->allocated = FREE;
+    footer->block_size = block->block_size;
+    block_t *next = (void *)block + block->block_size;
+    next->prev_allocated = FREE;
+    block = coalesce(arena, block);
+#if MM_TRIM_THRESHOLD
+    if (block->block_size >= limit)
+        trim_block(arena, block, lo, hi);
+#endif
 }
-static void checkblock(block_t *block) {
-    if ((uint64_t)block->body.payload % 8) {
-        printf("Error: payload for block at %p is not aligned\n", block);
+
+#if MM_DEFER_COALESCE
+/*
+ * quick_free - Put a freed block on the quick list of its size, the arena lock must be held
+ The block stays marked allocated, so its neighbours do not coalesce with it. A list
+ growing past QUICK_COUNT blocks sweeps the arena.
+ */
+static void quick_free(arena_t *arena, block_t *block) {
+    int list = QUICK_LIST(block->block_size);
+    *(block_t **)block->body.payload = arena->quick[list];
+    arena->quick[list] = block;
+    if (++arena->quick_counts[list] > QUICK_COUNT)
+        sweep_quick(arena);
+}
+
+/*
+ * sweep_quick - Free and coalesce every block on the quick lists of an arena, its lock must be held
+ Returns whether there was any.
+ */
+static bool sweep_quick(arena_t *arena) {
+    bool swept = false;
+    for (int list = 0; list < QUICK_LISTS; list++) {
+        block_t *block = arena->quick[list];
+        while (block != NULL) {
+            block_t *next = *(block_t **)block->body.payload;
+            heap_free(arena, block);
+            block = next;
+        }
+        swept |= arena->quick[list] != NULL;
+        arena->quick[list] = NULL;
+        arena->quick_counts[list] = 0;
     }
+    return swept;
+}
+#endif
+
+#if MM_MMAP_THRESHOLD
+/*
+ * is_mapped - is the payload in a mapped region rather than the heap?
+ */
+static inline bool is_mapped(void *payload) {
+    return (size_t)((char *)payload - heap_base) >= MAX_HEAP;
+}
+
+/*
+ * is_region - does the payload outside the heap start a mapped region of map_malloc?
+ A region starts a page and its payload follows the header in that page, so reading the
+ header never leaves the page of the payload, whoever it belongs to.
+ */
+static bool is_region(void *payload) {
+    char *region = (char *)payload - MAP_HEADER_SIZE;
+    if ((uintptr_t)payload % mem_pagesize() != MAP_HEADER_SIZE)
+        return false;
+    return ((size_t *)region)[1] == ((uintptr_t)region ^ MAP_TAG);
+}
+
+/*
+ * map_size - size of a region for a payload of size bytes: its header and the payload, in whole pages
+ Returns 0 when that does not fit a size_t.
+ */
+static size_t map_size(size_t size) {
+    size_t page = mem_pagesize();
+    if (size > SIZE_MAX - MAP_HEADER_SIZE - page)
+        return 0;
+    return (MAP_HEADER_SIZE + size + page - 1) & ~(page - 1);
+}
+
+/*
+ * map_malloc - Allocate a mapped region with size bytes of payload
+ */
+static void *map_malloc(size_t size) {
+    size_t region_size = map_size(size);
+    char *region;
+
+    if (region_size == 0 || (region = mem_map(region_size)) == NULL)
+        return NULL;
+    ((size_t *)region)[0] = region_size;
+    ((size_t *)region)[1] = (uintptr_t)region ^ MAP_TAG;
+    return region + MAP_HEADER_SIZE;
+}
+
+/*
+ * map_realloc - Resize a mapped region to size bytes of payload with mem_remap
+ The payload stays where it is when the region keeps its number of pages. Otherwise the
+ system grows or shrinks the region, moving its pages to other addresses when it cannot
+ grow in place, so the payload is never copied.
+ */
+static void *map_realloc(void *payload, size_t size) {
+    char *region = (char *)payload - MAP_HEADER_SIZE;
+    size_t old_size = *(size_t *)region;
+    size_t new_size = map_size(size);
+
+    if (new_size == 0)
+        return NULL;
+    if (new_size == old_size)
+        return payload;
+    if ((region = mem_remap(region, old_size, new_size)) == NULL)
+        return NULL;
+    ((size_t *)region)[0] = new_size;
+    ((size_t *)region)[1] = (uintptr_t)region ^ MAP_TAG;
+    return region + MAP_HEADER_SIZE;
+}
+
+/*
+ * map_free - Unmap a mapped region
+ */
+static void map_free(void *payload) {
+    char *region = (char *)payload - MAP_HEADER_SIZE;
+    mem_unmap(region, *(size_t *)region);
+}
+#endif
+
+#if MM_TRIM_THRESHOLD
+/*
+ * trim_block - Give the memory of a large free block back to the system, the arena lock must be held
+ lo and hi bound the memory of the block that may still be committed: what was just freed
+ and the free neighbours it merged with that were too small to be trimmed. The rest of the
+ block was trimmed before, so a block is not given back again by every free next to it.
+ Case 1: the block is last in the arena's last segment at the top of the heap, lower the
+    top of the heap to leave the block trim_pad bytes and move the epilogue down
+ Case 2: otherwise, or when another arena grew the heap in the meantime, decommit the
+    pages of lo..hi between the free list links and the footer, which read as zeros
+    from then on
+ */
+static void trim_block(arena_t *arena, block_t *block, char *lo, char *hi) {
+    block_t *next = (void *)block + block->block_size;
+    char *top = (char *)next + sizeof(header_t);
+    size_t pad = __atomic_load_n(&trim_pad, __ATOMIC_RELAXED);
+
+    if (next == arena->epilogue && top == (char *)mem_heap_hi() + 1) {
+        size_t keep = (char *)block - heap_base + MIN_BLOCK_SIZE + pad + sizeof(header_t);
+        char *new_top = heap_base + ((keep + TRIM_UNIT - 1) & ~(size_t)(TRIM_UNIT - 1));
+        if (new_top < top && mem_trim(top, top - new_top) == 0) { /* Case 1 */
+            __atomic_store_n(&trim_given, top - new_top, __ATOMIC_RELAXED);
+            set_arena_map(new_top, top - new_top, ARENA_NONE);
+            remove_free_block(arena, block);
+            block->block_size = new_top - sizeof(header_t) - (char *)block;
+            footer_t *footer = get_footer(block);
+            footer->allocated = FREE;
+            footer->block_size = block->block_size;
+            block_t *epilogue = (void *)new_top - sizeof(header_t);
+            epilogue->allocated = ALLOC;
+            epilogue->prev_allocated = FREE;
+            epilogue->block_size = 0;
+            arena->epilogue = epilogue;
+            insert_free_block(arena, block);
+            return;
+        }
+    }
+    /* Case 2 */
+    char *start = (char *)block + MIN_BLOCK_SIZE;
+    char *end = (char *)get_footer(block);
+    if (lo > start)
+        start = lo;
+    if (hi < end)
+        end = hi;
+    if (end > start)
+        mem_decommit(start, end - start);
+}
+#endif
+
+/*
+ * heap_realloc - Resize an allocated block to asize bytes without a new allocation, the arena
+ lock must be held. Returns the block now holding the payload, or NULL when it cannot be done.
+ Case 1: the block is large enough already, split off what it no longer needs
+ Case 2: the block and the free block after it are large enough, absorb that block
+ Case 3: the block, maybe followed by a free block, ends the arena's last segment at the
+    top of the heap, extend the heap by what is missing and absorb the new free block
+ Case 4: the free block before it together with the block, and the free block after it,
+    are large enough, slide the payload down into the block before with memmove
+ In every case the part not needed by asize bytes is split off when it can be a block.
+ */
+static block_t *heap_realloc(arena_t *arena, block_t *block, size_t asize) {
+    block_t *next = (void *)block + block->block_size;
+    size_t next_size = next->allocated ? 0 : next->block_size;
+
+    if (asize <= block->block_size) { /* Case 1 */
+        shrink_block(arena, block, asize);
+        return block;
+    }
+    if (block->block_size + next_size < asize) {
+        /* the block or its free neighbour is last in the arena's last segment at the top of the heap */
+        block_t *last = (void *)next + next_size;
+        if (last == arena->epilogue && (void *)last + sizeof(header_t) == mem_heap_hi() + 1) {
+            size_t missing = asize - block->block_size - next_size;
+            /* the new free block must be able to hold its free list links until it is absorbed */
+            if (missing < MIN_BLOCK_SIZE)
+                missing = MIN_BLOCK_SIZE;
+            if (extend_heap(arena, (missing + 7) >> 3) != NULL) { /* Case 3 */
+                next_size = next->allocated ? 0 : next->block_size;
+            }
+        }
+    }
+    if (block->block_size + next_size >= asize && block->block_size + next_size <= MAX_BLOCK_SIZE) { /* Case 2 */
+        remove_free_block(arena, next);
+        merge_cursor(next, block);
+        block->block_size += next_size;
+        shrink_block(arena, block, asize);
+        return block;
+    }
+    if (!block->prev_allocated) { /* Case 4 */
+        footer_t *prev_footer = (void *)block - sizeof(footer_t);
+        block_t *prev = (void *)block - prev_footer->block_size;
+        size_t total = prev->block_size + block->block_size + next_size;
+        if (total < asize || total > MAX_BLOCK_SIZE)
+            return NULL;
+        remove_free_block(arena, prev);
+        merge_cursor(block, prev);
+        if (next_size > 0) {
+            remove_free_block(arena, next);
+            merge_cursor(next, prev);
+        }
+        memmove(prev->body.payload, block->body.payload, block->block_size - OVERHEAD);
+        prev->allocated = ALLOC;
+        prev->block_size = total;
+        shrink_block(arena, prev, asize);
+        return prev;
+    }
+    return NULL;
+}
+
+/*
+ * shrink_block - Give back the end of an allocated block beyond asize bytes, the arena lock must be held
+ The rest is freed, and so coalesced with the block after it, when it is large enough to be a
+ block; otherwise the block keeps it. Either way the block after it learns that the block is allocated.
+ */
+static void shrink_block(arena_t *arena, block_t *block, size_t asize) {
+    size_t rest_size = block->block_size - asize;
+
+    if (rest_size < MIN_BLOCK_SIZE) {
+        block_t *next = (void *)block + block->block_size;
+        next->prev_allocated = ALLOC;
+        return;
+    }
+    STAT_ADD(splits, 1);
+    block->block_size = asize;
+    block_t *rest = (void *)block + asize;
+    rest->allocated = ALLOC;
+    rest->prev_allocated = ALLOC;
+    rest->block_size = rest_size;
+    heap_free(arena, rest);
+}
+
+/*
+ * adjust_size - block size for a payload of size bytes
+ The size of the header is added and the result aligned to a multiple of MM_ALIGNMENT, but at least MIN_BLOCK_SIZE.
+ */
+HOT uint32_t adjust_size(size_t size) {
+    /* Adjust block size to include overhead and alignment reqs. */
+    size += OVERHEAD;
+    uint32_t asize = ALIGN(size); /* align to multiple of MM_ALIGNMENT */
+
+    if (asize < MIN_BLOCK_SIZE) {
+        asize = MIN_BLOCK_SIZE;
+    }
+    return asize;
+}
+
+#if MM_TCACHE
+/*
+ * heap_free_list - Return a NULL terminated list of payloads linked through their first word
+ Each slab object goes back to its run and each block to its own arena. The lock of an
+ arena is held across a sequence of objects owned by the same arena instead of being
+ taken for every object.
+ */
+static void heap_free_list(void *list) {
+    arena_t *locked = NULL;
+    while (list != NULL) {
+        void *payload = list;
+        block_t *block = payload - sizeof(header_t);
+        list = *(void **)payload;
+#if MM_SLAB
+        run_t *run = is_slab(payload) ? run_of(payload) : NULL;
+        arena_t *arena = (run != NULL) ? run->arena : arena_of(block);
+#else
+        arena_t *arena = arena_of(block);
+#endif
+        if (arena != locked) {
+            if (locked != NULL)
+                UNLOCK_ARENA(locked);
+            LOCK_ARENA(arena);
+            locked = arena;
+        }
+#if MM_SLAB
+        if (run != NULL) {
+            slab_free(run, payload);
+            continue;
+        }
+#endif
+        heap_free(arena, block);
+    }
+    if (locked != NULL)
+        UNLOCK_ARENA(locked);
+}
+#endif
+
+/*
+ * mm_realloc - Change the size of the payload at ptr to size bytes
+ A NULL ptr is a plain mm_malloc and a size of 0 a plain mm_free.
+ A mapped region is resized by map_realloc while size stays at least MM_MMAP_THRESHOLD.
+ A slab object keeps its place while size still fits the object. A block is first
+ resized in place by heap_realloc under the lock of its arena. Only when that fails,
+ or a payload moves between the heap and a mapped region, is a new block allocated,
+ the payload copied and the old block freed.
+ */
+void *mm_realloc(void *ptr, size_t size) {
+    void *newp;
+    size_t copySize;
+
+    if (ptr == NULL)
+        return mm_malloc(size);
+    if (size == 0) {
+        mm_free(ptr);
+        return NULL;
+    }
+    STAT_ADD(reallocs, 1);
+#if MM_CHECK
+    if (!valid_payload(ptr))
+        return NULL;
+#endif
+    block_t* block = ptr - sizeof(header_t);
+#if MM_MMAP_THRESHOLD
+    if (is_mapped(ptr) && size >= MM_MMAP_THRESHOLD) {
+        newp = map_realloc(ptr, size);
+        CHECK_HEAP();
+        return newp;
+    }
+    if (is_mapped(ptr) || size >= MM_MMAP_THRESHOLD) {
+        copySize = mm_usable_size(ptr);
+    } else
+#else
+    if (size > MAX_BLOCK_SIZE - OVERHEAD)
+        return NULL;
+#endif
+#if MM_SLAB
+    if (is_slab(ptr)) {
+        copySize = run_of(ptr)->obj_size;
+        if (size <= copySize)
+            return ptr;
+    } else
+#endif
+    {
+        arena_t *arena = arena_of(block);
+        LOCK_ARENA(arena);
+        block_t *moved = heap_realloc(arena, block, adjust_size(size));
+        UNLOCK_ARENA(arena);
+        CHECK_HEAP();
+        if (moved != NULL)
+            return moved->body.payload;
+        copySize = block->block_size - OVERHEAD;
+    }
+
+    if ((newp = mm_malloc(size)) == NULL)
+        return NULL;
+    if (size < copySize)
+        copySize = size;
+    memcpy(newp, ptr, copySize);
+    mm_free(ptr);
+    return newp;
+}
+
+/*
+ * mm_memalign - Allocate size bytes of payload at a multiple of alignment, a power of two
+ Alignments up to MM_ALIGNMENT are what mm_malloc gives anyway. For larger ones a block
+ with room for the payload, alignment and a free block in front is taken from the arena.
+ The allocated block starts where its payload lands on the first multiple of alignment
+ that is at least MIN_BLOCK_SIZE into the free block, so the part in front stays a free
+ block, and shrink_block gives back what is left behind it. Such a block is an ordinary
+ block from then on, so mm_free and mm_realloc take it like any other.
+ */
+void *mm_memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1)))
+        return NULL;
+    if (alignment <= MM_ALIGNMENT)
+        return mm_malloc(size);
+    if (size == 0 || size > MAX_BLOCK_SIZE - OVERHEAD || alignment > MAX_BLOCK_SIZE)
+        return NULL;
+
+    size_t asize = adjust_size(size);
+    if (asize + alignment + MIN_BLOCK_SIZE > MAX_BLOCK_SIZE)
+        return NULL;
+    arena_t *arena = current_arena();
+    LOCK_ARENA(arena);
+    block_t *block = heap_fit(arena, asize + alignment + MIN_BLOCK_SIZE);
+    if (block == NULL) {
+        UNLOCK_ARENA(arena);
+        return NULL;
+    }
+    remove_free_block(arena, block);
+
+    uintptr_t payload = (uintptr_t)block->body.payload;
+    uintptr_t aligned = payload;
+    if (payload & (alignment - 1))
+        aligned = (payload + MIN_BLOCK_SIZE + alignment - 1) & ~(uintptr_t)(alignment - 1);
+    size_t front = aligned - payload;
+    size_t total = block->block_size;
+    bool prev_alloc = block->prev_allocated;
+    block_t *aligned_block = (void *)aligned - sizeof(header_t);
+    if (front > 0) {
+        STAT_ADD(splits, 1);
+        block->block_size = front;
+        footer_t *footer = get_footer(block);
+        footer->allocated = FREE;
+        footer->block_size = front;
+        insert_free_block(arena, block);
+    }
+    aligned_block->allocated = ALLOC;
+    aligned_block->prev_allocated = (front > 0) ? FREE : prev_alloc;
+    aligned_block->block_size = total - front;
+    shrink_block(arena, aligned_block, asize);
+    UNLOCK_ARENA(arena);
+    return count_malloc(size, aligned_block->body.payload);
+}
+
+/*
+ * mm_usable_size - Bytes of payload the allocation at ptr may use, at least what was asked for
+ */
+size_t mm_usable_size(void *ptr) {
+    if (ptr == NULL)
+        return 0;
+#if MM_MMAP_THRESHOLD
+    if (is_mapped(ptr))
+        return *(size_t *)(ptr - MAP_HEADER_SIZE) - MAP_HEADER_SIZE;
+#endif
+#if MM_SLAB
+    if (is_slab(ptr))
+        return run_of(ptr)->obj_size;
+#endif
+    block_t *block = ptr - sizeof(header_t);
+    return block->block_size - OVERHEAD;
+}
+
+/*
+ * mm_owns - Did mm_malloc return ptr? True for payloads in the heap and in mapped regions,
+ false for memory of another allocator, which the caller must not pass to mm_free or mm_realloc
+ */
+int mm_owns(void *ptr) {
+    if ((char *)ptr >= heap_base && (char *)ptr <= (char *)mem_heap_hi())
+        return 1;
+#if MM_MMAP_THRESHOLD
+    if (is_mapped(ptr) && is_region(ptr))
+        return 1;
+#endif
+    return 0;
+}
+
+/*
+ * mm_set_placement - Choose how free blocks are picked for requests
+ policy is one of MM_GOOD_FIT, MM_FIRST_FIT, MM_NEXT_FIT and MM_BEST_FIT. For MM_GOOD_FIT
+ scan bounds how many large enough blocks of the class of a request are compared when no
+ larger class has one, 0 for all of them, 1 (the default) takes the first. The policy holds
+ for every arena and survives mm_init. Returns 0, or -1 if the arguments are not valid.
+ */
+int mm_set_placement(int policy, int scan) {
+    if (policy < MM_GOOD_FIT || policy > MM_BEST_FIT || scan < 0)
+        return -1;
+    placement = policy;
+    placement_scan = scan;
+    return 0;
+}
+
+/*
+ * mm_thread_safe - May several threads call the allocator at once? True in the MM_THREADS build
+ */
+int mm_thread_safe(void) {
+    return MM_THREADS;
+}
+
+/*
+ * mm_stats - Fill in stats, see mm.h
+ The counters are added up as the allocator runs, the free list figures are found by
+ walking the free lists of every arena under their locks, and the lock waits are kept
+ by the arenas of the MM_THREADS build. Blocks held by thread caches
+ or quick lists count as allocated. Returns 0, or -1 when built without MM_STATS, in
+ which case the counters are 0.
+ */
+int mm_stats(mm_stats_t *stats) {
+#if MM_STATS
+    *stats = counters;
+#else
+    memset(stats, 0, sizeof(*stats));
+#endif
+    for (int i = 0; i < num_arenas; i++) {
+        LOCK_ARENA(&arenas[i]);
+        for (int cls = 0; cls < NUM_CLASSES; cls++) {
+            for (block_t *block = arenas[i].free_lists[cls]; block != NULL; block = next_free(block)) {
+                stats->free_blocks[stats_class(block->block_size)]++;
+                stats->free_bytes += block->block_size;
+                if (block->block_size > stats->largest_free)
+                    stats->largest_free = block->block_size;
+            }
+        }
+#if MM_TREE_THRESHOLD
+        for (block_t *block = tree_fit(&arenas[i], 0); block != NULL; block = tree_next(block)) {
+            stats->free_blocks[stats_class(block->block_size)]++;
+            stats->free_bytes += block->block_size;
+            if (block->block_size > stats->largest_free)
+                stats->largest_free = block->block_size;
+        }
+#endif
+#if MM_THREADS
+        stats->lock_waits += arenas[i].lock_waits;
+#endif
+        UNLOCK_ARENA(&arenas[i]);
+    }
+    return MM_STATS ? 0 : -1;
+}
+
+/*
+ * mm_checkheap - Check the heap for consistency
+ The heap is a sequence of segments, each starting with a prologue and ending with an epilogue.
+ For each segment: prints prologue, and checks if it it's size of blocksize and if it allocated.
+ Traverses the segment and prints out all the blocks, counting the free ones and
+ checking that every prev a/f bit is right and no two free blocks that fit in one
+ block are next to each other.
+ Prints epilogue and checks if it's size if zero and if it is allocated.
+ Finally walks every free list of every arena and checks that each block on it is free,
+ belongs to that size class and arena and is linked back correctly, and that every free
+ block in the heap is on some list or, with MM_TREE_THRESHOLD, in the tree (see checktree). Blocks on quick lists must be allocated and of the
+ size of their list. Slab runs, found as allocated blocks, are checked by checkrun
+ and the same way against the run lists.
+ */
+void mm_checkheap(int verbose) {
+    block_t *block;
+    int heap_free = 0, list_free = 0;
+    int heap_runs = 0, list_runs = 0;
+
+    for (int i = 0; i < num_arenas; i++)
+        LOCK_ARENA(&arenas[i]);
+    if (verbose)
+        printf("Heap (%p):\n", prologue);
+    for (block_t *segment = prologue; (void *)segment < mem_heap_hi(); segment = (void *)block + sizeof(header_t) + SEGMENT_PAD) {
+        block_t *prev = segment;
+        if (segment->block_size != PROLOGUE_SIZE || !segment->allocated)
+            printf("Bad prologue header\n");
+        checkblock(segment);
+        /* iterate through the segment (both free and allocated blocks will be present) */
+        for (block = (void*)segment+segment->block_size; block->block_size > 0; block = (void *)block + block->block_size) {
+            if (verbose)
+                printblock(block);
+            checkblock(block);
+            if (block->prev_allocated != prev->allocated)
+                printf("Error: prev a/f bit of block %p does not match block %p\n", block, prev);
+#if MM_SLAB
+            if (block->allocated && is_slab(block->body.payload))
+                heap_runs += checkrun(run_of(block->body.payload), verbose);
+#endif
+            if (!block->allocated) {
+                if (!prev->allocated && prev->block_size + block->block_size <= MAX_BLOCK_SIZE)
+                    printf("Error: free blocks at %p not coalesced\n", block);
+                heap_free++;
+            }
+            prev = block;
+        }
+        if (verbose)
+            printblock(block);
+        if (block->block_size != 0 || !block->allocated)
+            printf("Bad epilogue header\n");
+        if (block->prev_allocated != prev->allocated)
+            printf("Error: prev a/f bit of epilogue %p does not match block %p\n", block, prev);
+    }
+
+    /* iterate through the free lists */
+    for (int i = 0; i < num_arenas; i++) {
+        arena_t *arena = &arenas[i];
+        if (arena->epilogue != NULL && (arena->epilogue->block_size != 0 || !arena->epilogue->allocated))
+            printf("Error: arena %d epilogue %p is not an epilogue\n", i, arena->epilogue);
+        if (arena->rover != NULL && (arena->rover->allocated || arena_of(arena->rover) != arena))
+            printf("Error: arena %d rover %p is not a free block of the arena\n", i, arena->rover);
+        for (int cls = 0; cls < NUM_CLASSES; cls++) {
+            block_t *prev = NULL;
+            for (block = arena->free_lists[cls]; block != NULL; block = next_free(block)) {
+                if (block->allocated)
+                    printf("Error: allocated block %p in free list %d\n", block, cls);
+                if (size_class(block->block_size) != cls)
+                    printf("Error: block %p of size %d in free list %d\n", block, block->block_size, cls);
+                if (arena_of(block) != arena)
+                    printf("Error: block %p in free list of arena %d it does not belong to\n", block, i);
+                if (prev_free(block) != prev)
+                    printf("Error: bad prev pointer in free block %p\n", block);
+                prev = block;
+                list_free++;
+            }
+        }
+#if MM_TREE_THRESHOLD
+        list_free += checktree(arena, i);
+#endif
+#if MM_DEFER_COALESCE
+        for (int list = 0; list < QUICK_LISTS; list++) {
+            int count = 0;
+            for (block = arena->quick[list]; block != NULL; block = *(block_t **)block->body.payload) {
+                if (!block->allocated)
+                    printf("Error: free block %p in quick list %d\n", block, list);
+                if (QUICK_LIST(block->block_size) != list)
+                    printf("Error: block %p of size %d in quick list %d\n", block, block->block_size, list);
+                if (arena_of(block) != arena)
+                    printf("Error: block %p in quick list of arena %d it does not belong to\n", block, i);
+                count++;
+            }
+            if (count != arena->quick_counts[list])
+                printf("Error: quick list %d of arena %d has %d blocks but counts %d\n", list, i, count, arena->quick_counts[list]);
+        }
+#endif
+#if MM_SLAB
+        for (int cls = 0; cls < SLAB_CLASSES; cls++) {
+            run_t *prev = NULL;
+            for (run_t *run = arena->runs[cls]; run != NULL; run = run->next) {
+                if (run->obj_size != SLAB_OBJ_SIZE(cls))
+                    printf("Error: run %p of object size %d in run list %d\n", run, run->obj_size, cls);
+                if (run->free_count == 0)
+                    printf("Error: full run %p in run list %d\n", run, cls);
+                if (run->arena != arena)
+                    printf("Error: run %p in run list of arena %d it does not belong to\n", run, i);
+                if (run->prev != prev)
+                    printf("Error: bad prev pointer in run %p\n", run);
+                prev = run;
+                list_runs++;
+            }
+        }
+#endif
+    }
+    if (heap_free != list_free)
+        printf("Error: %d free blocks in heap but %d in free lists\n", heap_free, list_free);
+    if (heap_runs != list_runs)
+        printf("Error: %d runs with free objects in heap but %d in run lists\n", heap_runs, list_runs);
+    for (int i = num_arenas - 1; i >= 0; i--)
+        UNLOCK_ARENA(&arenas[i]);
+}
+
+/*
+ * mm_checkheap_step - Check the next blocks blocks of the heap, going on from where the last call stopped
+ An incremental mm_checkheap, cheap enough to leave on: each call looks at a bounded
+ number of blocks from a cursor, which merges of the block it is at move to the block
+ it was merged into, and which wraps around to the prologue at the end of the heap.
+ The walk stays in the segments of one arena, under its lock, and stops early at a
+ segment of another arena. The blocks are taken CHECK_WINDOW at a time, up to the end
+ of their segment:
+ Case 1: each block lies in the heap, its payload is aligned, it is at least MIN_BLOCK_SIZE
+    bytes (the prologue PROLOGUE_SIZE) and the prev a/f bit of the block after it is right.
+    The free bits of the headers of the window are collected in a bitmap.
+ Case 2: each free block matches its footer, is not followed by a free block it would fit
+    in one block with, and is linked into its free list or the tree (see checkfree)
+ Case 3: the blocks of the window the free blocks link to are marked in a second bitmap,
+    which must fall within the first: a block on a free list is free. A link into the
+    window that does not lead to the start of a block is an error too.
+ Returns the number of errors, which are printed like those of mm_checkheap. A block
+ whose size leads out of the heap stops the walk, and the next call starts over.
+ */
+int mm_checkheap_step(int blocks) {
+    block_t *window[CHECK_WINDOW], *links[3];
+    block_t *block, *next;
+    arena_t *arena;
+    int errors = 0;
+
+    /* merges can move the cursor until the lock of the arena owning its block is held */
+    for (;;) {
+        if ((block = __atomic_load_n(&check_cursor, __ATOMIC_RELAXED)) == NULL)
+            block = prologue;
+        arena = arena_of(block);
+        LOCK_ARENA(arena);
+        next = __atomic_load_n(&check_cursor, __ATOMIC_RELAXED);
+        if (next == NULL)
+            next = prologue;
+        if (next == block || arena_of(next) == arena)
+            break;
+        UNLOCK_ARENA(arena);
+    }
+    block = next;
+
+    while (blocks > 0) {
+        uint64_t free_bits = 0, linked_bits = 0;
+        int n = 0;
+        for (; n < CHECK_WINDOW && blocks > 0 && block->block_size > 0; n++, blocks--) { /* Case 1 */
+            next = (void *)block + block->block_size;
+            if ((uintptr_t)block->body.payload % MM_ALIGNMENT || !in_heap(next) || next <= block) {
+                printf("Error: block %p has a bad header\n", block);
+                block = NULL;
+                errors++;
+                goto done;
+            }
+            if (block->block_size < MIN_BLOCK_SIZE && (block->block_size != PROLOGUE_SIZE || !block->allocated)) {
+                printf("Error: block %p of size %d is too small\n", block, block->block_size);
+                errors++;
+            }
+            if (next->prev_allocated != block->allocated) {
+                printf("Error: prev a/f bit of block %p does not match block %p\n", next, block);
+                errors++;
+            }
+            if (!block->allocated)
+                free_bits |= 1ULL << n;
+            window[n] = block;
+            block = next;
+        }
+        for (int i = 0; i < n; i++) {
+            int num_links;
+            if (!((free_bits >> i) & 1))
+                continue;
+            errors += checkfree(arena, window[i], links, &num_links); /* Case 2 */
+            for (int j = 0; j < num_links; j++) { /* Case 3 */
+                if (links[j] < window[0] || links[j] > window[n - 1])
+                    continue;
+                int k = window_index(window, n, links[j]);
+                if (k < 0) {
+                    printf("Error: free block %p links into the middle of a block at %p\n", window[i], links[j]);
+                    errors++;
+                } else {
+                    linked_bits |= 1ULL << k;
+                }
+            }
+        }
+        for (uint64_t bits = linked_bits & ~free_bits; bits != 0; bits &= bits - 1) {
+            printf("Error: allocated block %p is on a free list\n", window[__builtin_ctzll(bits)]);
+            errors++;
+        }
+        if (block->block_size == 0) {
+            /* the epilogue, the next segment starts past the pad in front of its prologue */
+            if (!block->allocated) {
+                printf("Bad epilogue header\n");
+                block = NULL;
+                errors++;
+                break;
+            }
+            block = (void *)block + sizeof(header_t) + SEGMENT_PAD;
+            if ((void *)block >= mem_heap_hi())
+                block = prologue;
+#if MM_ARENAS > 1
+            /* the brk is raised before the new granules are recorded, so start over from
+               an unrecorded one and leave a segment of another arena to a call holding its lock */
+            int owner = __atomic_load_n(&arena_map[((char *)block - heap_base) >> ARENA_GRANULE_SHIFT], __ATOMIC_RELAXED);
+            if (owner == ARENA_NONE) {
+                block = prologue;
+                break;
+            }
+            if (&arenas[owner] != arena)
+                break;
+#endif
+        }
+    }
+done:
+    __atomic_store_n(&check_cursor, block, __ATOMIC_RELAXED);
+    UNLOCK_ARENA(arena);
+    return errors;
+}
+
+/* The remaining routines are internal helper routines */
+
+/*
+ * current_arena - The arena the calling thread allocates from
+ A thread is given an arena round robin on its first call and keeps it.
+ */
+HOT arena_t *current_arena(void) {
+#if MM_ARENAS > 1
+    if (thread_arena < 0)
+        thread_arena = __atomic_fetch_add(&next_arena, 1, __ATOMIC_RELAXED) % num_arenas;
+    return &arenas[thread_arena];
+#else
+    return &arenas[0];
+#endif
+}
+
+/*
+ * arena_of - The arena a block belongs to, found from the granule it lies in
+ */
+HOT arena_t *arena_of(block_t *block) {
+#if MM_ARENAS > 1
+    return &arenas[arena_map[((char *)block - heap_base) >> ARENA_GRANULE_SHIFT]];
+#else
+    return &arenas[0];
+#endif
+}
+
+/*
+ * set_arena_map - Record owner as the owner of the granules of start..start+len
+ The owner is stored before a granule's memory is laid out, both under the owner's lock,
+ so mm_checkheap_step reads the headers of a granule only while holding the lock of the
+ arena that initialised them. Granules given back to the system become ARENA_NONE again,
+ a stale owner would still be on them when another arena grows the heap there.
+ */
+static void set_arena_map(char *start, size_t len, int owner) {
+#if MM_ARENAS > 1
+    for (size_t offset = 0; offset < len; offset += ARENA_GRANULE)
+        __atomic_store_n(&arena_map[(start + offset - heap_base) >> ARENA_GRANULE_SHIFT], owner, __ATOMIC_RELAXED);
+#else
+    (void)start, (void)len, (void)owner;
+#endif
+}
+
+/*
+ * extend_heap - Extend an arena with a free block and return its block pointer
+ The size is rounded up to a multiple of MM_ALIGNMENT. With several arenas the size is rounded up to whole granules, which are recorded as owned by
+ the arena.
+ When memlib backs the heap with huge pages the size is rounded up again so the heap ends
+ on a huge page boundary, and every huge page the heap grows into is used whole.
+ Case 1: the new memory directly follows the epilogue of the arena's last segment
+    Make the old epilogue head of new free block and coalesce
+    Find new epilogue which is at the end of the heap
+ Case 2: the new memory is somewhere else (another arena grew in between, or the arena is new)
+    Start a new segment there
+ */
+/* $begin mmextendheap */
+static block_t *extend_heap(arena_t *arena, size_t words) {
+    block_t *block;
+    uint32_t size;
+    size = ALIGN(words << 3); // words*8
+#if MM_ARENAS > 1
+    size = (size + ARENA_GRANULE - 1) & ~(ARENA_GRANULE - 1);
+#endif
+    /* on huge pages the heap grows to the end of a huge page, which the next blocks fill */
+    size_t huge = mem_hugepagesize();
+    if (huge > 0 && size > 0)
+        size += (huge - ((uintptr_t)mem_heap_hi() + 1 + size) % huge) % huge;
+    if (size == 0 || (block = mem_sbrk(size)) == (void *)-1)
+        return NULL;
+#if MM_TRIM_THRESHOLD
+    /* the heap wanted back what the last trim gave, keep that much next time */
+    size_t given = __atomic_exchange_n(&trim_given, 0, __ATOMIC_RELAXED);
+    if (given > 0)
+        __atomic_store_n(&trim_pad, (trim_pad + given < TRIM_PAD_MAX) ? trim_pad + given : TRIM_PAD_MAX, __ATOMIC_RELAXED);
+#endif
+    set_arena_map((char *)block, size, arena - arenas);
+    if ((void *)block != (void *)arena->epilogue + sizeof(header_t))
+        return coalesce(arena, init_segment(arena, block, size));
+    /* The newly acquired region will start directly after the epilogue block */
+    /* Initialize free block header/footer and the new epilogue header */
+    /* use old epilogue as new free block header, it already knows if the block before is allocated */
+    block = (void *)block - sizeof(header_t);
+    block->allocated = FREE;
+    block->block_size = size;
+    /* free block footer */
+    footer_t *block_footer = get_footer(block);
+    block_footer->allocated = FREE;
+    block_footer->block_size = block->block_size;
+    /* new epilogue header */
+    block_t *new_epilogue = (void *)block_footer + sizeof(footer_t);
+    new_epilogue->allocated = ALLOC;
+    new_epilogue->prev_allocated = FREE;
+    new_epilogue->block_size = 0;
+    arena->epilogue = new_epilogue;
+    /* Coalesce if the previous block was free */
+    return coalesce(arena, block);
+}
+/* $end mmextendheap */
+
+/*
+ * init_segment - Lay out a prologue, one free block and an epilogue over size bytes at start
+ A pad of SEGMENT_PAD bytes moves the blocks to 4 before a multiple of MM_ALIGNMENT. The prologue is an allocated
+ block made of only a header and a footer, so the first real block always has an
+ allocated block in front of it while coalescing.
+ The epilogue is a header of size 0 at the very end of the segment.
+ The segment becomes the arena's last one; the free block is returned without being put
+ on a free list.
+ */
+static block_t *init_segment(arena_t *arena, void *start, size_t size) {
+    /* initialize the prologue */
+    block_t *segment_prologue = start + SEGMENT_PAD;
+    segment_prologue->allocated = ALLOC;
+    segment_prologue->prev_allocated = ALLOC;
+    segment_prologue->block_size = PROLOGUE_SIZE;
+    footer_t *prologue_footer = get_footer(segment_prologue);
+    prologue_footer->allocated = ALLOC;
+    prologue_footer->block_size = PROLOGUE_SIZE;
+    /* initialize the first free block */
+    block_t *init_block = (void *)segment_prologue + PROLOGUE_SIZE;
+    init_block->allocated = FREE;
+    init_block->prev_allocated = ALLOC;
+    init_block->block_size = size - SEGMENT_OVERHEAD; //pad, prologue and epilogue header
+    footer_t *init_footer = get_footer(init_block);
+    init_footer->allocated = FREE;
+    init_footer->block_size = init_block->block_size;
+    /* initialize the epilogue - block size 0 will be used as a terminating condition */
+    block_t *epilogue = (void *)init_block + init_block->block_size;
+    epilogue->allocated = ALLOC;
+    epilogue->prev_allocated = FREE;
+    epilogue->block_size = 0;
+    arena->epilogue = epilogue;
+    return init_block;
+}
+
+/*
+ * place -
+ The free block is first taken off its free list. Allocated blocks get no footer,
+ the block after an allocated block has its prev a/f bit set.
+ Case 1: Leftover space in block after allocating block is greater than or equal to Minimum Block size
+    Case 1a: Payload is less than or equal to 100
+        Split the block according to block size such that the first part of free block is allocated and the second part is free.
+        This way all the smaller block will be at the beginning of the heap.
+        Insert the new smaller free block in the free list of its class.
+    Case 1b: Payload is greater than 100
+        Split the block such that the latter part (the latter block_size bytes of free block are marked as allocated).
+        All larger blocks are placed towards the end of the heap.
+        Insert the remaining free block back in the free list of its (new) class.
+ Case 2: Leftover psace in block is smaller than Minimum block size
+    Mark block as allocated
+ */
+/* $begin mmplace */
+HOT block_t *place(arena_t *arena, block_t *block, size_t asize) {
+    size_t split_size = block->block_size - asize;
+
+    remove_free_block(arena, block);
+    if (split_size >= MIN_BLOCK_SIZE) {
+        STAT_ADD(splits, 1);
+        if (asize - OVERHEAD <= 100) {
+            /* split the block by updating the header and marking it allocated*/
+            block->block_size = asize;
+            block->allocated = ALLOC;
+            /* update the header of the new free block */
+            block_t *new_block = (void *)block + block->block_size;
+            new_block->block_size = split_size;
+            new_block->allocated = FREE;
+            new_block->prev_allocated = ALLOC;
+            /* update the footer of the new free block */
+            footer_t *new_footer = get_footer(new_block);
+            new_footer->block_size = split_size;
+            new_footer->allocated = FREE;
+            insert_free_block(arena, new_block);
+            return block;
+        } else {
+            //find header of this new block with updated size thats at the end of the free block
+            block_t *b = (void *)block + split_size;
+            b->block_size = asize; //update header
+            b->allocated = ALLOC;
+            b->prev_allocated = FREE;
+            block_t *next = (void *)b + asize;
+            next->prev_allocated = ALLOC;
+
+            //creating new block at the beginning
+            block->block_size = split_size;
+            block->allocated = FREE; //already marked free
+            footer_t *footer = get_footer(block);
+            footer->block_size = split_size;
+            footer->allocated = FREE;
+            insert_free_block(arena, block);
+            return b;
+        }
+    } else {
+        /* splitting the block will cause a splinter so we just include it in the allocated block */
+        block->allocated = ALLOC;
+        block_t *next = (void *)block + block->block_size;
+        next->prev_allocated = ALLOC;
+        return block;
+    }
+}
+/* $end mmplace */
+
+/*
+ * find_fit - Find a fit for a block with asize bytes as the placement policy says
+ MM_GOOD_FIT:
+    Case 1: the head of the class asize falls in is large enough, take it
+    Case 2: any block of a larger class is large enough, so take the head of the first
+       non-empty class above it, found in constant time through the bitmaps
+    Case 3: no larger class has a block, take the smallest of the first placement_scan
+       large enough blocks of the class asize falls in
+ MM_FIRST_FIT: the first large enough block of the class asize falls in, else the head of
+    the first non-empty class above it
+ MM_NEXT_FIT: as first fit, but the search of the class starts from the rover, the block
+    after the last one taken, and wraps around to the head
+ MM_BEST_FIT: the smallest large enough block of the class asize falls in, else the
+    smallest block of the first non-empty class above it
+ With MM_TREE_THRESHOLD a request for a block of at least that size takes the smallest,
+ and of those the lowest, large enough block of the tree whatever the policy.
+ */
+HOT block_t *find_fit(arena_t *arena, size_t asize) {
+    block_t *b, *fit;
+    int cls = size_class(asize);
+
+    STAT_ADD(fits, 1);
+#if MM_TREE_THRESHOLD
+    if (asize >= MM_TREE_THRESHOLD)
+        return tree_fit(arena, asize);
+#endif
+    switch (placement) {
+    case MM_FIRST_FIT:
+        fit = scan_fit(arena->free_lists[cls], NULL, asize, 1);
+        break;
+    case MM_NEXT_FIT:
+        b = arena->rover;
+        if (b == NULL || size_class(b->block_size) != cls)
+            b = arena->free_lists[cls];
+        if ((fit = scan_fit(b, NULL, asize, 1)) == NULL)
+            fit = scan_fit(arena->free_lists[cls], b, asize, 1);
+        if (fit == NULL)
+            fit = larger_fit(arena, cls);
+        /* taking the block off its list moves the rover to the block after it */
+        arena->rover = fit;
+#if MM_TREE_THRESHOLD
+        /* a block of the tree has no list to move along, the search starts from the head */
+        if (fit != NULL && fit->block_size >= MM_TREE_THRESHOLD)
+            arena->rover = NULL;
+#endif
+        return fit;
+    case MM_BEST_FIT:
+        if ((fit = scan_fit(arena->free_lists[cls], NULL, asize, 0)) == NULL && (b = larger_fit(arena, cls)) != NULL)
+            fit = scan_fit(b, NULL, asize, 0);
+        return fit;
+    default:
+        if ((b = arena->free_lists[cls]) != NULL && asize <= b->block_size) {
+            STAT_ADD(probes, 1);
+            return b;
+        }
+        if ((b = larger_fit(arena, cls)) != NULL)
+            return b;
+        return scan_fit(arena->free_lists[cls], NULL, asize, placement_scan);
+    }
+    return (fit != NULL) ? fit : larger_fit(arena, cls);
+}
+
+/*
+ * scan_fit - The smallest of the first scan blocks from block up to end on a free list
+ that have at least asize bytes, all of them if scan is 0. A block of exactly asize bytes
+ ends the scan. Returns NULL if none has.
+ */
+HOT block_t *scan_fit(block_t *block, block_t *end, size_t asize, int scan) {
+    block_t *fit = NULL;
+    for (; block != end; block = next_free(block)) {
+        STAT_ADD(probes, 1);
+        if (asize > block->block_size)
+            continue;
+        if (fit == NULL || block->block_size < fit->block_size)
+            fit = block;
+        if (fit->block_size == asize || --scan == 0)
+            break;
+    }
+    return fit;
+}
+
+/*
+ * larger_fit - The head of the first non-empty class above cls, NULL if there is none
+ With MM_TREE_THRESHOLD the classes from TREE_CLASS up are the tree, of which it takes
+ the smallest block.
+ */
+HOT block_t *larger_fit(arena_t *arena, int cls) {
+    if (cls + 1 >= NUM_CLASSES)
+        return NULL;
+    int larger = find_nonempty_class(arena, cls + 1);
+#if MM_TREE_THRESHOLD
+    if (larger >= TREE_CLASS)
+        return tree_fit(arena, 0);
+#endif
+    block_t *block = arena->free_lists[larger];
+    if (block != NULL)
+        STAT_ADD(probes, 1);
+    return block;
+}
+
+/*
+ * coalesce - boundary tag coalescing. Return ptr to coalesced block
+ The block passed in is free but not on any free list.
+ The status (free or allocated) of the adjacent blocks are found, the previous one
+ from the prev a/f bit, as only a free previous block has a footer to look at.
+ Free neighbours are taken off their free lists and merged, and the result is
+ inserted into the free list of its size class. A neighbour that would push the
+ size past MAX_BLOCK_SIZE is left alone.
+ */
+static block_t *coalesce(arena_t *arena, block_t *block) {
+    footer_t *prev_footer = (void *)block - sizeof(footer_t);
+    header_t *next_header = (void *)block + block->block_size;
+    bool prev_alloc = block->prev_allocated;
+    bool next_alloc = next_header->allocated;
+
+    if (!prev_alloc && prev_footer->block_size + block->block_size > MAX_BLOCK_SIZE)
+        prev_alloc = true;
+    if (!next_alloc && block->block_size + next_header->block_size +
+                       (prev_alloc ? 0 : prev_footer->block_size) > MAX_BLOCK_SIZE)
+        next_alloc = true;
+
+    if (prev_alloc && next_alloc) { /* Case 1 */
+        /* no coalesceing */
+    }
+    else if (prev_alloc && !next_alloc) { /* Case 2 */
+        STAT_ADD(coalesces, 1);
+        /* Update header of current block to include next block's size */
+        remove_free_block(arena, (void *)next_header);
+        merge_cursor((void *)next_header, block);
+        block->block_size += next_header->block_size;
+        /* Update footer of next block to reflect new size */
+        footer_t *next_footer = get_footer(block);
+        next_footer->block_size = block->block_size;
+    }
+    else if (!prev_alloc && next_alloc) { /* Case 3 */
+        STAT_ADD(coalesces, 1);
+        /* Update header of prev block to include current block's size */
+        block_t *prev_block = (void *)prev_footer - prev_footer->block_size + sizeof(footer_t);
+        remove_free_block(arena, prev_block);
+        merge_cursor(block, prev_block);
+        prev_block->block_size += block->block_size;
+        /* Update footer of current block to reflect new size */
+        footer_t *footer = get_footer(prev_block);
+        footer->block_size = prev_block->block_size;
+        block = prev_block;
+    }
+    else { /* Case 4 */
+        STAT_ADD(coalesces, 2);
+        /* Update header of prev block to include current and next block's size */
+        block_t *prev_block = (void *)prev_footer - prev_footer->block_size + sizeof(footer_t);
+        remove_free_block(arena, prev_block);
+        remove_free_block(arena, (void *)next_header);
+        merge_cursor(block, prev_block);
+        merge_cursor((void *)next_header, prev_block);
+        prev_block->block_size += block->block_size + next_header->block_size;
+        /* Update footer of next block to reflect new size */
+        footer_t *next_footer = get_footer(prev_block);
+        next_footer->block_size = prev_block->block_size;
+        block = prev_block;
+    }
+    insert_free_block(arena, block);
+    return block;
+}
+
+/*
+ * size_class - index of the free list holding blocks of the given size
+ Sizes below 1 << FL_SHIFT all map to first level 0 and are split in steps of 8,
+ of which only every other one is used with MM_ALIGNMENT 16.
+ Above that the first level is the position of the highest set bit and the second
+ level the SL_SHIFT bits right below it.
+ */
+HOT int size_class(size_t size) {
+    int fl, sl;
+    if (size < (1 << FL_SHIFT)) {
+        fl = 0;
+        sl = size >> 3;
+    } else {
+        int msb = 31 - __builtin_clz(size);
+        fl = msb - FL_SHIFT + 1;
+        sl = (size >> (msb - SL_SHIFT)) & (SL_COUNT - 1);
+    }
+    return fl * SL_COUNT + sl;
+}
+
+/*
+ * find_nonempty_class - index of the first non-empty free list at or above cls
+ First looks at the rest of cls's second level bitmap, then at the first level
+ bitmap for the next first level class with any free block.
+ Returns cls itself when every list from cls up is empty, the caller finds that
+ list empty.
+ */
+HOT int find_nonempty_class(arena_t *arena, int cls) {
+    int fl = cls >> SL_SHIFT;
+    uint32_t sl_map = arena->sl_bitmap[fl] & (~0U << (cls & (SL_COUNT - 1)));
+    if (sl_map == 0) {
+        uint32_t fl_map = arena->fl_bitmap & (~0U << (fl + 1));
+        if (fl_map == 0)
+            return cls;
+        fl = __builtin_ctz(fl_map);
+        sl_map = arena->sl_bitmap[fl];
+    }
+    return fl * SL_COUNT + __builtin_ctz(sl_map);
+}
+
+/*
+ * insert_free_block - push a free block on the front of the list of its class
+ With MM_TREE_THRESHOLD a block of at least that size goes in the tree instead.
+ */
+HOT void insert_free_block(arena_t *arena, block_t *block) {
+#if MM_TREE_THRESHOLD
+    if (block->block_size >= MM_TREE_THRESHOLD) {
+        tree_insert(arena, block);
+        return;
+    }
+#endif
+    int cls = size_class(block->block_size);
+    block_t **head = &arena->free_lists[cls];
+    set_prev_free(block, NULL);
+    set_next_free(block, *head);
+    if (*head != NULL)
+        set_prev_free(*head, block);
+    *head = block;
+    arena->sl_bitmap[cls >> SL_SHIFT] |= 1U << (cls & (SL_COUNT - 1));
+    arena->fl_bitmap |= 1U << (cls >> SL_SHIFT);
+}
+
+/*
+ * remove_free_block - unlink a free block from the list of its class, or the tree
+ */
+HOT void remove_free_block(arena_t *arena, block_t *block) {
+#if MM_TREE_THRESHOLD
+    if (block->block_size >= MM_TREE_THRESHOLD) {
+        tree_remove(arena, block);
+        return;
+    }
+#endif
+    block_t *p = prev_free(block);
+    block_t *t = next_free(block);
+    if (arena->rover == block)
+        arena->rover = t;
+    if (t != NULL)
+        set_prev_free(t, p);
+    if (p != NULL) {
+        set_next_free(p, t);
+    } else {
+        int cls = size_class(block->block_size);
+        arena->free_lists[cls] = t;
+        /* the list became empty, clear its bit and maybe its first level bit */
+        if (t == NULL) {
+            int fl = cls >> SL_SHIFT;
+            arena->sl_bitmap[fl] &= ~(1U << (cls & (SL_COUNT - 1)));
+            if (arena->sl_bitmap[fl] == 0)
+                arena->fl_bitmap &= ~(1U << fl);
+        }
+    }
+}
+
+#if MM_TREE_THRESHOLD
+/*
+ * The free blocks of at least MM_TREE_THRESHOLD bytes of an arena form a treap: a binary
+ * search tree ordered by size and then address, whose nodes are also heap ordered by a
+ * priority hashed from their address. The priorities are as good as random, so the tree
+ * stays balanced in expectation, O(log n) deep, without storing any balance information.
+ * Its links are kept in the payload of each block, in place of the list links.
+ */
+
+/*
+ * tree_fit - The smallest block of the tree with at least asize bytes, the lowest of
+ them when several are as small, NULL if there is none
+ */
+static block_t *tree_fit(arena_t *arena, size_t asize) {
+    block_t *fit = NULL;
+    for (block_t *node = arena->tree; node != NULL;) {
+        STAT_ADD(probes, 1);
+        if (node->block_size >= asize) {
+            fit = node;
+            node = tree_child(node, 0);
+        } else {
+            node = tree_child(node, 1);
+        }
+    }
+    return fit;
+}
+
+/*
+ * tree_insert - Add a free block to the tree
+ The block goes in as a leaf where the search order puts it and is rotated up
+ as long as its priority is above that of its parent.
+ The bitmap bit of TREE_CLASS is set, larger_fit finds the tree through it.
+ */
+static void tree_insert(arena_t *arena, block_t *block) {
+    block_t *parent = NULL;
+    int side = 0;
+    for (block_t *node = arena->tree; node != NULL; node = tree_child(node, side)) {
+        parent = node;
+        side = tree_less(node, block);
+    }
+    set_tree_child(block, 0, NULL);
+    set_tree_child(block, 1, NULL);
+    set_tree_parent(block, parent);
+    if (parent == NULL)
+        arena->tree = block;
+    else
+        set_tree_child(parent, side, block);
+    while ((parent = tree_parent(block)) != NULL && tree_priority(block) > tree_priority(parent))
+        tree_rotate_up(arena, block);
+    arena->sl_bitmap[TREE_CLASS >> SL_SHIFT] |= 1U << (TREE_CLASS & (SL_COUNT - 1));
+    arena->fl_bitmap |= 1U << (TREE_CLASS >> SL_SHIFT);
+}
+
+/*
+ * tree_remove - Take a free block out of the tree
+ The block is rotated down below the child of higher priority until it is a leaf,
+ which is then cut off. The bitmap bit of TREE_CLASS is cleared with the last block.
+ */
+static void tree_remove(arena_t *arena, block_t *block) {
+    while (tree_child(block, 0) != NULL || tree_child(block, 1) != NULL) {
+        block_t *left = tree_child(block, 0), *right = tree_child(block, 1);
+        if (left == NULL || (right != NULL && tree_priority(right) > tree_priority(left)))
+            tree_rotate_up(arena, right);
+        else
+            tree_rotate_up(arena, left);
+    }
+    block_t *parent = tree_parent(block);
+    if (parent == NULL)
+        arena->tree = NULL;
+    else
+        set_tree_child(parent, tree_child(parent, 1) == block, NULL);
+    if (arena->tree == NULL) {
+        int fl = TREE_CLASS >> SL_SHIFT;
+        arena->sl_bitmap[fl] &= ~(1U << (TREE_CLASS & (SL_COUNT - 1)));
+        if (arena->sl_bitmap[fl] == 0)
+            arena->fl_bitmap &= ~(1U << fl);
+    }
+}
+
+/*
+ * tree_rotate_up - Rotate a block of the tree above its parent, keeping the search order
+ The subtree of the block on the side of its parent becomes the parent's subtree
+ in the block's place.
+ */
+static void tree_rotate_up(arena_t *arena, block_t *block) {
+    block_t *parent = tree_parent(block);
+    block_t *grand = tree_parent(parent);
+    int side = tree_child(parent, 1) == block;
+    block_t *inner = tree_child(block, !side);
+
+    set_tree_child(parent, side, inner);
+    if (inner != NULL)
+        set_tree_parent(inner, parent);
+    set_tree_child(block, !side, parent);
+    set_tree_parent(parent, block);
+    set_tree_parent(block, grand);
+    if (grand == NULL)
+        arena->tree = block;
+    else
+        set_tree_child(grand, tree_child(grand, 1) == parent, block);
+}
+
+/*
+ * tree_next - The block after block in the search order, NULL for the last one
+ */
+static block_t *tree_next(block_t *block) {
+    block_t *next = tree_child(block, 1);
+    if (next != NULL) {
+        while (tree_child(next, 0) != NULL)
+            next = tree_child(next, 0);
+        return next;
+    }
+    while ((next = tree_parent(block)) != NULL && tree_child(next, 1) == block)
+        block = next;
+    return next;
+}
+
+/*
+ * tree_less - Does the search order of the tree put a before b?
+ */
+static inline bool tree_less(block_t *a, block_t *b) {
+    return a->block_size < b->block_size || (a->block_size == b->block_size && a < b);
+}
+
+/*
+ * tree_priority - The heap order priority of a block, hashed from its address
+ */
+static inline uint32_t tree_priority(block_t *block) {
+    return (uint32_t)(((uintptr_t)block >> ALIGN_SHIFT) * 2654435761u);
+}
+
+/*
+ * checktree - Check the tree of an arena and return the number of blocks in it
+ Every block must be free, of at least MM_TREE_THRESHOLD bytes and of the arena, be
+ the child of its parent, follow the block before it in the search order and have a
+ priority no higher than its parent's. The bitmap bit of TREE_CLASS must tell
+ whether the tree has any block.
+ */
+static int checktree(arena_t *arena, int index) {
+    block_t *prev = NULL;
+    int count = 0;
+    bool bit = (arena->sl_bitmap[TREE_CLASS >> SL_SHIFT] >> (TREE_CLASS & (SL_COUNT - 1))) & 1;
+
+    if (arena->tree != NULL && tree_parent(arena->tree) != NULL)
+        printf("Error: root %p of the tree of arena %d has a parent\n", arena->tree, index);
+    if (bit != (arena->tree != NULL))
+        printf("Error: tree bit of arena %d is %d but the tree is %sempty\n", index, bit, arena->tree ? "not " : "");
+    for (block_t *block = tree_fit(arena, 0); block != NULL; block = tree_next(block)) {
+        block_t *parent = tree_parent(block);
+        if (block->allocated)
+            printf("Error: allocated block %p in tree\n", block);
+        if (block->block_size < MM_TREE_THRESHOLD)
+            printf("Error: block %p of size %d in tree\n", block, block->block_size);
+        if (arena_of(block) != arena)
+            printf("Error: block %p in tree of arena %d it does not belong to\n", block, index);
+        if (parent != NULL && tree_child(parent, 0) != block && tree_child(parent, 1) != block)
+            printf("Error: block %p in tree is not a child of its parent %p\n", block, parent);
+        if (parent != NULL && tree_priority(block) > tree_priority(parent))
+            printf("Error: block %p in tree has a higher priority than its parent %p\n", block, parent);
+        if (prev != NULL && !tree_less(prev, block))
+            printf("Error: block %p in tree out of order after %p\n", block, prev);
+        prev = block;
+        count++;
+    }
+    return count;
+}
+
+static inline block_t *tree_child(block_t *block, int side) {
+#if MM_COMPACT_LINKS
+    return block->body.tree.child[side] ? (block_t *)(heap_base + block->body.tree.child[side]) : NULL;
+#else
+    return block->body.tree.child[side];
+#endif
+}
+
+static inline block_t *tree_parent(block_t *block) {
+#if MM_COMPACT_LINKS
+    return block->body.tree.parent ? (block_t *)(heap_base + block->body.tree.parent) : NULL;
+#else
+    return block->body.tree.parent;
+#endif
+}
+
+static inline void set_tree_child(block_t *block, int side, block_t *child) {
+#if MM_COMPACT_LINKS
+    block->body.tree.child[side] = child ? (char *)child - heap_base : 0;
+#else
+    block->body.tree.child[side] = child;
+#endif
+}
+
+static inline void set_tree_parent(block_t *block, block_t *parent) {
+#if MM_COMPACT_LINKS
+    block->body.tree.parent = parent ? (char *)parent - heap_base : 0;
+#else
+    block->body.tree.parent = parent;
+#endif
+}
+#endif
+
+#if MM_SLAB
+/*
+ * is_slab - true iff payload lies in a page of slab memory
+ */
+static inline bool is_slab(void *payload) {
+    size_t page = ((char *)payload - heap_base) >> RUN_SHIFT;
+    return (run_map[page >> 6] >> (page & 63)) & 1;
+}
+
+/*
+ * run_of - the run holding a slab object
+ */
+static inline run_t *run_of(void *payload) {
+    return (run_t *)(heap_base + (((char *)payload - heap_base) & ~(size_t)(RUN_SIZE - 1)));
+}
+
+/*
+ * slab_malloc - Take an object of slab class cls from an arena, its lock must be held
+ Only runs with a free object are on the list of a class, so the first one always has
+ one; the lowest set bit of its free bitmap names the object. A run that becomes full
+ leaves the list. With no run on the list a new one is made.
+ */
+static void *slab_malloc(arena_t *arena, int cls) {
+    run_t *run = arena->runs[cls];
+    int word = 0;
+
+    if (run == NULL && (run = new_run(arena, cls)) == NULL)
+        return NULL;
+    while (run->free_map[word] == 0)
+        word++;
+    int index = word * 64 + __builtin_ctzll(run->free_map[word]);
+    run->free_map[word] &= run->free_map[word] - 1;
+    if (--run->free_count == 0)
+        unlink_run(run);
+    return (char *)run + RUN_HEADER_SIZE + index * run->obj_size;
+}
+
+/*
+ * slab_free - Give an object back to its run, the lock of the run's arena must be held
+ Case 1: the run was full, it goes back on the front of its class list
+ Case 2: every object of the run is now free and the class has other runs, the run
+    leaves the class list and its block goes back to the heap
+ Case 3: otherwise the run stays where it is
+ */
+static void slab_free(run_t *run, void *payload) {
+    arena_t *arena = run->arena;
+    int cls = SLAB_CLASS(run->obj_size);
+    unsigned index = ((char *)payload - (char *)run - RUN_HEADER_SIZE) / run->obj_size;
+
+    run->free_map[index >> 6] |= 1ULL << (index & 63);
+    if (run->free_count++ == 0) { /* Case 1 */
+        run->prev = NULL;
+        run->next = arena->runs[cls];
+        if (run->next != NULL)
+            run->next->prev = run;
+        arena->runs[cls] = run;
+    } else if (run->free_count == run->obj_count && (run->prev != NULL || run->next != NULL)) { /* Case 2 */
+        unlink_run(run);
+        size_t page = ((char *)run - heap_base) >> RUN_SHIFT;
+        __atomic_fetch_and(&run_map[page >> 6], ~(1ULL << (page & 63)), __ATOMIC_RELAXED);
+        heap_free(arena, (void *)run - sizeof(header_t));
+    }
+}
+
+/*
+ * new_run - Make a run of slab class cls and put it on the class list
+ The run is cut from the front of a free block of at least RUN_BLOCK_SIZE bytes, like
+ the other small blocks, as the allocated block whose payload starts on the first page
+ boundary at least MIN_BLOCK_SIZE into it. The parts in front of and behind it stay free
+ when they are large enough to be blocks. The run's page is then marked in run_map.
+ */
+static run_t *new_run(arena_t *arena, int cls) {
+    block_t *block = heap_fit(arena, RUN_BLOCK_SIZE);
+    if (block == NULL)
+        return NULL;
+    remove_free_block(arena, block);
+
+    char *payload = (char *)block->body.payload;
+    size_t offset = payload - heap_base;
+    char *page = payload;
+    if (offset & (RUN_SIZE - 1))
+        page = heap_base + ((offset + MIN_BLOCK_SIZE + RUN_SIZE - 1) & ~(size_t)(RUN_SIZE - 1));
+    size_t front = page - payload;
+    size_t back = block->block_size - front - RUN_SIZE;
+    bool prev_alloc = block->prev_allocated;
+    block_t *run_block = (void *)page - sizeof(header_t);
+    if (front > 0) {
+        STAT_ADD(splits, 1);
+        block->block_size = front;
+        footer_t *footer = get_footer(block);
+        footer->allocated = FREE;
+        footer->block_size = front;
+        insert_free_block(arena, block);
+    }
+    run_block->allocated = ALLOC;
+    run_block->prev_allocated = (front > 0) ? FREE : prev_alloc;
+    if (back >= MIN_BLOCK_SIZE) {
+        STAT_ADD(splits, 1);
+        run_block->block_size = RUN_SIZE;
+        block_t *rest = (void *)run_block + RUN_SIZE;
+        rest->allocated = FREE;
+        rest->prev_allocated = ALLOC;
+        rest->block_size = back;
+        footer_t *footer = get_footer(rest);
+        footer->allocated = FREE;
+        footer->block_size = back;
+        insert_free_block(arena, rest);
+    } else {
+        /* too little is left behind the run for a block, the run block keeps it */
+        run_block->block_size = RUN_SIZE + back;
+        block_t *next = (void *)run_block + run_block->block_size;
+        next->prev_allocated = ALLOC;
+    }
+
+    size_t map_page = (page - heap_base) >> RUN_SHIFT;
+    /* other arenas may mark pages in the same word of run_map at the same time */
+    __atomic_fetch_or(&run_map[map_page >> 6], 1ULL << (map_page & 63), __ATOMIC_RELAXED);
+    if (page + RUN_SIZE > arena->runs_end)
+        arena->runs_end = page + RUN_SIZE;
+
+    run_t *run = (run_t *)page;
+    run->arena = arena;
+    run->obj_size = SLAB_OBJ_SIZE(cls);
+    run->obj_count = RUN_OBJ_COUNT(run->obj_size);
+    run->free_count = run->obj_count;
+    for (int word = 0; word < RUN_MAP_WORDS; word++) {
+        int left = run->obj_count - word * 64;
+        run->free_map[word] = (left >= 64) ? ~0ULL : (left > 0) ? (1ULL << left) - 1 : 0;
+    }
+    run->prev = NULL;
+    run->next = arena->runs[cls];
+    if (run->next != NULL)
+        run->next->prev = run;
+    arena->runs[cls] = run;
+    return run;
+}
+
+/*
+ * unlink_run - take a run off the list of its class
+ */
+static void unlink_run(run_t *run) {
+    if (run->next != NULL)
+        run->next->prev = run->prev;
+    if (run->prev != NULL)
+        run->prev->next = run->next;
+    else
+        run->arena->runs[SLAB_CLASS(run->obj_size)] = run->next;
+}
+
+/*
+ * checkrun - Check a run found in the heap, returns 1 iff it has a free object
+ */
+static int checkrun(run_t *run, bool verbose) {
+    int free_count = 0;
+
+    if (verbose)
+        printf("%p: run: [%d:%d/%d]\n", run, run->obj_size, run->free_count, run->obj_count);
+    if (run->obj_size == 0 || run->obj_size > SLAB_MAX_SIZE || run->obj_size % MM_ALIGNMENT) {
+        printf("Error: run %p has bad object size %d\n", run, run->obj_size);
+        return 0;
+    }
+    if (run->obj_count != RUN_OBJ_COUNT(run->obj_size))
+        printf("Error: run %p has %d objects of size %d\n", run, run->obj_count, run->obj_size);
+    if (run->arena < arenas || run->arena >= arenas + num_arenas)
+        printf("Error: run %p belongs to no arena\n", run);
+    for (int word = 0; word < RUN_MAP_WORDS; word++) {
+        int left = run->obj_count - word * 64;
+        uint64_t valid = (left >= 64) ? ~0ULL : (left > 0) ? (1ULL << left) - 1 : 0;
+        if (run->free_map[word] & ~valid)
+            printf("Error: run %p marks objects past its end free\n", run);
+        free_count += __builtin_popcountll(run->free_map[word]);
+    }
+    if (free_count != run->free_count)
+        printf("Error: run %p has %d free objects but counts %d\n", run, free_count, run->free_count);
+    return run->free_count > 0;
+}
+#endif
+
+#if MM_TCACHE
+/*
+ * tcache_reset - Empty the calling thread's cache and tie it to the current heap
+ Called on a thread's first use of its cache and after mm_init started a new heap,
+ in which case the cached objects belong to the old heap and are simply dropped.
+ */
+static void tcache_reset(void) {
+    memset(&tcache, 0, sizeof(tcache));
+    tcache.epoch = heap_epoch;
+    pthread_once(&tcache_key_once, tcache_make_key);
+    pthread_setspecific(tcache_key, &tcache);
+}
+
+/*
+ * tcache_take - Get the payload of a new object for a cache bin from an arena, its lock must be held
+ */
+static void *tcache_take(arena_t *arena, int bin) {
+#if MM_SLAB
+    if (bin < SLAB_CLASSES)
+        return slab_malloc(arena, bin);
+#endif
+    block_t *block = heap_malloc(arena, MIN_BLOCK_SIZE + ((bin - SLAB_CLASSES) << ALIGN_SHIFT));
+    return (block != NULL) ? block->body.payload : NULL;
+}
+
+/*
+ * tcache_malloc - Allocate an object of a cache bin from the calling thread's cache
+ When the bin is empty it is refilled with up to TCACHE_BATCH objects taken from the
+ thread's arena under a single acquisition of the arena lock.
+ */
+static void *tcache_malloc(int bin) {
+    void *payload;
+
+    if (tcache.epoch != heap_epoch)
+        tcache_reset();
+    if ((payload = tcache.bins[bin]) != NULL) {
+        tcache.bins[bin] = *(void **)payload;
+        tcache.counts[bin]--;
+        return payload;
+    }
+    arena_t *arena = current_arena();
+    LOCK_ARENA(arena);
+    payload = tcache_take(arena, bin);
+    for (int i = 1; payload != NULL && i < TCACHE_BATCH; i++) {
+        void *extra = tcache_take(arena, bin);
+        if (extra == NULL)
+            break;
+        /* place may have absorbed a splinter, such a block belongs in another bin */
+        block_t *block = extra - sizeof(header_t);
+        if (bin >= SLAB_CLASSES && TCACHE_BIN(block->block_size) != bin) {
+            heap_free(arena, block);
+            break;
+        }
+        *(void **)extra = tcache.bins[bin];
+        tcache.bins[bin] = extra;
+        tcache.counts[bin]++;
+    }
+    UNLOCK_ARENA(arena);
+    return payload;
+}
+
+/*
+ * tcache_free - Put an object back in bin of the calling thread's cache
+ A bin that grows past TCACHE_COUNT gives TCACHE_BATCH objects back to their arenas.
+ */
+static void tcache_free(void *payload, int bin) {
+    if (tcache.epoch != heap_epoch)
+        tcache_reset();
+    *(void **)payload = tcache.bins[bin];
+    tcache.bins[bin] = payload;
+    if (++tcache.counts[bin] <= TCACHE_COUNT)
+        return;
+    /* cut the first TCACHE_BATCH objects off the bin */
+    void *last = tcache.bins[bin];
+    for (int i = 1; i < TCACHE_BATCH; i++)
+        last = *(void **)last;
+    payload = tcache.bins[bin];
+    tcache.bins[bin] = *(void **)last;
+    tcache.counts[bin] -= TCACHE_BATCH;
+    *(void **)last = NULL;
+    heap_free_list(payload);
+}
+
+/*
+ * tcache_flush - Give every object of a thread cache back to its arena
+ Runs as the destructor of tcache_key when a thread exits.
+ */
+static void tcache_flush(void *cache) {
+    tcache_t *tc = cache;
+    if (tc->epoch != heap_epoch)
+        return;
+    for (int bin = 0; bin < TCACHE_BINS; bin++) {
+        heap_free_list(tc->bins[bin]);
+        tc->bins[bin] = NULL;
+        tc->counts[bin] = 0;
+    }
+}
+
+static void tcache_make_key(void) {
+    pthread_key_create(&tcache_key, tcache_flush);
+}
+#endif
+
+#if MM_THREADS
+/*
+ * lock_arena - Take the lock of an arena, counting a wait if another thread holds it
+ The count is bumped once the lock is held, so it needs no atomics.
+ */
+static inline void lock_arena(arena_t *arena) {
+    if (pthread_mutex_trylock(&arena->lock) != 0) {
+        pthread_mutex_lock(&arena->lock);
+        arena->lock_waits++;
+    }
+}
+
+static void init_arena_locks(void) {
+    for (int i = 0; i < MM_ARENAS; i++)
+        pthread_mutex_init(&arenas[i].lock, NULL);
+    pthread_atfork(lock_arenas, unlock_arenas, init_arenas_after_fork);
+}
+
+/*
+ * lock_arenas - Take every arena lock before a fork, so no arena is halfway through a change
+ */
+static void lock_arenas(void) {
+    for (int i = 0; i < MM_ARENAS; i++)
+        LOCK_ARENA(&arenas[i]);
+}
+
+/*
+ * unlock_arenas - Release the arena locks in the parent after a fork
+ */
+static void unlock_arenas(void) {
+    for (int i = MM_ARENAS - 1; i >= 0; i--)
+        UNLOCK_ARENA(&arenas[i]);
+}
+
+/*
+ * init_arenas_after_fork - Give the only thread of a forked child fresh arena locks
+ */
+static void init_arenas_after_fork(void) {
+    for (int i = 0; i < MM_ARENAS; i++)
+        pthread_mutex_init(&arenas[i].lock, NULL);
+}
+#endif
+
+/*
+ * next_free, prev_free, set_next_free, set_prev_free - read and write the links of a free block
+ With MM_COMPACT_LINKS a link is the offset of the block from heap_base, offset 0 is
+ the pad word in front of the first prologue so it never names a block and stands for NULL.
+ */
+static inline block_t *next_free(block_t *block) {
+#if MM_COMPACT_LINKS
+    return block->body.next ? (block_t *)(heap_base + block->body.next) : NULL;
+#else
+    return block->body.next;
+#endif
+}
+
+static inline block_t *prev_free(block_t *block) {
+#if MM_COMPACT_LINKS
+    return block->body.prev ? (block_t *)(heap_base + block->body.prev) : NULL;
+#else
+    return block->body.prev;
+#endif
+}
+
+static inline void set_next_free(block_t *block, block_t *next) {
+#if MM_COMPACT_LINKS
+    block->body.next = next ? (char *)next - heap_base : 0;
+#else
+    block->body.next = next;
+#endif
+}
+
+static inline void set_prev_free(block_t *block, block_t *prev) {
+#if MM_COMPACT_LINKS
+    block->body.prev = prev ? (char *)prev - heap_base : 0;
+#else
+    block->body.prev = prev;
+#endif
+}
+
+//finding footer of a free block
+HOT footer_t* get_footer(block_t *block) {
+    return (void*)block + block->block_size - sizeof(footer_t);
+}
+
+//prints address, header and, for free blocks, footer of block
+static void printblock(block_t *block) {
+    uint32_t hsize, halloc, hprev, fsize, falloc;
+    hsize = block->block_size;
+    halloc = block->allocated;
+    hprev = block->prev_allocated;
+    if (hsize == 0) {
+        printf("%p: EOL\n", block);
+        return;
+    }
+    if (halloc) {
+        printf("%p: header: [%d:%c%c]\n", block, hsize, (hprev ? 'a' : 'f'), 'a');
+        return;
+    }
+    footer_t *footer = get_footer(block);
+    fsize = footer->block_size;
+    falloc = footer->allocated;
+    printf("%p: header: [%d:%c%c] footer: [%d:%c] prev: %p next %p\n", block, hsize,
+           (hprev ? 'a' : 'f'), 'f', fsize, (falloc ? 'a' : 'f'), prev_free(block), next_free(block));
+}
+
+/*
+ * checkfree - Check a free block and that it is linked into the free lists of its arena, return the number of errors
+ The free block after it, its footer and the blocks it is linked to must be in the
+ heap, and those blocks must link back to it. A block without a previous block must
+ head the free list of its class; in the tree a block without a parent is the root.
+ The blocks it links to are stored in links, their number in num_links.
+ */
+static int checkfree(arena_t *arena, block_t *block, block_t **links, int *num_links) {
+    footer_t *footer = get_footer(block);
+    block_t *next = (void *)block + block->block_size;
+    int errors = 0;
+
+    *num_links = 0;
+    if (footer->block_size != block->block_size || footer->allocated) {
+        printf("Error: header of free block %p does not match footer\n", block);
+        errors++;
+    }
+    if (!next->allocated && block->block_size + next->block_size <= MAX_BLOCK_SIZE) {
+        printf("Error: free blocks at %p not coalesced\n", next);
+        errors++;
+    }
+#if MM_TREE_THRESHOLD
+    if (block->block_size >= MM_TREE_THRESHOLD) {
+        block_t *parent = tree_parent(block);
+        for (int side = 0; side < 2; side++) {
+            if (tree_child(block, side) != NULL)
+                links[(*num_links)++] = tree_child(block, side);
+        }
+        if (parent != NULL)
+            links[(*num_links)++] = parent;
+        for (int i = 0; i < *num_links; i++) {
+            if (!in_heap(links[i])) {
+                printf("Error: free block %p links out of the heap\n", block);
+                *num_links = 0;
+                return errors + 1;
+            }
+        }
+        if (parent == NULL ? arena->tree != block : tree_child(parent, 0) != block && tree_child(parent, 1) != block) {
+            printf("Error: free block %p is not linked into the tree\n", block);
+            errors++;
+        }
+        return errors;
+    }
+#endif
+    block_t *prev = prev_free(block);
+    next = next_free(block);
+    if ((prev != NULL && !in_heap(prev)) || (next != NULL && !in_heap(next))) {
+        printf("Error: free block %p links out of the heap\n", block);
+        return errors + 1;
+    }
+    if (prev == NULL ? arena->free_lists[size_class(block->block_size)] != block : next_free(prev) != block) {
+        printf("Error: free block %p is not linked into its free list\n", block);
+        errors++;
+    }
+    if (next != NULL && prev_free(next) != block) {
+        printf("Error: bad prev pointer in free block %p\n", next);
+        errors++;
+    }
+    if (prev != NULL)
+        links[(*num_links)++] = prev;
+    if (next != NULL)
+        links[(*num_links)++] = next;
+    return errors;
+}
+
+/*
+ * window_index - Index of block in the n blocks of window, which are in address order, -1 if none starts there
+ */
+static int window_index(block_t **window, int n, block_t *block) {
+    int lo = 0, hi = n - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (window[mid] == block)
+            return mid;
+        if (window[mid] < block)
+            lo = mid + 1;
+        else
+            hi = mid - 1;
+    }
+    return -1;
+}
+
+/*
+ * in_heap - Does ptr point into the heap?
+ */
+static inline bool in_heap(void *ptr) {
+    return (char *)ptr >= heap_base && (char *)ptr <= (char *)mem_heap_hi();
+}
+
+/*
+ * merge_cursor - Move the cursor of mm_checkheap_step off a block being merged into the block into
+ */
+static inline void merge_cursor(block_t *block, block_t *into) {
+    if (__atomic_load_n(&check_cursor, __ATOMIC_RELAXED) == block)
+        __atomic_store_n(&check_cursor, into, __ATOMIC_RELAXED);
+}
+
+static void checkblock(block_t *block) {
+    if ((uint64_t)block->body.payload % MM_ALIGNMENT) {
+        printf("Error: payload for block at %p is not aligned\n", block);
+    }
+    if (block->allocated)
+        return;
     footer_t *footer = get_footer(block);
-    if (block->block_size != footer->block_size && (block != prologue)) {
+    if (block->block_size != footer->block_size || footer->allocated) {
         printf("Error: header does not match footer\n");
     }
 }
@@ -4,6 +4,45 @@ extern int mm_init (void);
 extern void *mm_malloc (size_t size);
 extern void mm_free (void *ptr);
 extern void *mm_realloc(void *ptr, size_t size);
+extern void *mm_memalign(size_t alignment, size_t size);
+extern size_t mm_usable_size(void *ptr);
+extern int mm_owns(void *ptr);
+extern int mm_thread_safe(void);
+extern void mm_checkheap(int verbose);
+extern int mm_checkheap_step(int blocks);
+
+/* Allocate or free many payloads with one call, see mm.c */
+extern size_t mm_malloc_bulk(size_t size, size_t n, void **out);
+extern void mm_free_bulk(void **ptrs, size_t n);
+
+/* Placement policies of mm_set_placement */
+enum { MM_GOOD_FIT, MM_FIRST_FIT, MM_NEXT_FIT, MM_BEST_FIT };
+extern int mm_set_placement(int policy, int scan);
+
+/*
+ * What mm_stats reports. Sizes are counted in classes by power of two,
+ * class i holding sizes of more than 1 << (i - 1) and at most 1 << i
+ * bytes. The counters are kept only when mm.c is built with MM_STATS
+ * and since the last mm_init; the free list figures always describe the
+ * heap at the time of the call.
+ */
+#define MM_STATS_CLASSES 32
+typedef struct {
+    unsigned long mallocs[MM_STATS_CLASSES]; /* requests by their size */
+    unsigned long frees[MM_STATS_CLASSES];   /* frees by the usable size of the payload */
+    unsigned long reallocs;   /* mm_realloc calls with a payload and a size, those that move also count as a malloc and a free */
+    unsigned long fits;       /* find_fit searches */
+    unsigned long probes;     /* free blocks those searches looked at */
+    unsigned long splits;     /* blocks split in two to fit a request */
+    unsigned long coalesces;  /* free blocks merged with a neighbour */
+    unsigned long requested;  /* bytes requested from mm_malloc */
+    unsigned long granted;    /* usable bytes of the payloads it returned */
+    unsigned long free_blocks[MM_STATS_CLASSES]; /* blocks on the free lists by their size */
+    unsigned long free_bytes;    /* bytes in those blocks */
+    unsigned long largest_free;  /* size of the largest of them */
+    unsigned long lock_waits;    /* arena locks found taken since mm_init, kept by the thread safe build */
+} mm_stats_t;
+extern int mm_stats(mm_stats_t *stats);
 
 
 /*
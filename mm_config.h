@@ -0,0 +1,122 @@
+/*
+ * mm_config.h - Build options of mm.c
+ *
+ * Every option can be overridden on the compiler command line
+ * (e.g. -DMM_THREADS=1); the Makefile builds one driver per useful
+ * combination. The options are plain macros tested with #if, so a
+ * feature that is off compiles out of mm.c altogether:
+ *
+ *   mdriver          the defaults below
+ *   mdriver-fast     -O2, NDEBUG and MM_INLINE, no checks or counters
+ *   mdriver-debug    -O0 with MM_CHECK 2, the heap checked after every call
+ *   mdriver-compact  MM_COMPACT_LINKS, 32 bit free list links
+ *   mdriver-mt, -trim, -defer, -stats, -tree, -check  see the Makefile
+ *
+ * Include it after config.h and mm.h, for MAX_HEAP and MM_GOOD_FIT.
+ */
+
+/* Features */
+#ifndef MM_THREADS
+#define MM_THREADS 0 /* make the allocator safe to call from several threads */
+#endif
+#ifndef MM_TCACHE
+#define MM_TCACHE MM_THREADS /* serve small requests from a per-thread cache */
+#endif
+#ifndef MM_ARENAS
+#if MM_THREADS
+#define MM_ARENAS 16 /* most arenas, fewer are used on machines with fewer cpus */
+#else
+#define MM_ARENAS 1
+#endif
+#endif
+
+#ifndef MM_SLAB
+#define MM_SLAB 1 /* serve requests of up to SLAB_MAX_SIZE bytes from slab runs */
+#endif
+#ifndef MM_COMPACT_LINKS
+#define MM_COMPACT_LINKS 0 /* link free blocks by 32 bit offsets from the heap base instead of pointers */
+#endif
+#ifndef MM_ALIGNMENT
+#define MM_ALIGNMENT 8 /* alignment of every payload, 8 or 16 (what malloc must give on x86_64) */
+#endif
+#ifndef MM_MMAP_THRESHOLD
+#define MM_MMAP_THRESHOLD (1 << 17) /* requests of at least this many bytes get a mapped region of their own, 0 never */
+#endif
+#ifndef MM_TRIM_THRESHOLD
+#define MM_TRIM_THRESHOLD 0 /* freed blocks of at least this many bytes give their pages back, 0 never */
+#endif
+#ifndef MM_TRIM_PAD
+#define MM_TRIM_PAD (1 << 18) /* bytes the top of the heap keeps when trimmed, at first, like the top pad of the C library's malloc */
+#endif
+#ifndef MM_DEFER_COALESCE
+#define MM_DEFER_COALESCE 0 /* keep freed small blocks on quick lists and coalesce them in batches */
+#endif
+#ifndef MM_STATS
+#define MM_STATS 0 /* count requests, searches, splits and merges for mm_stats */
+#endif
+#ifndef MM_TREE_THRESHOLD
+#define MM_TREE_THRESHOLD 0 /* free blocks of at least this many bytes, a power of 2, go in a tree by size and address, 0 never */
+#endif
+
+/* Layout and policy */
+#ifndef MM_CHUNKSIZE
+#define MM_CHUNKSIZE (1 << 16) /* initial heap size and least growth of an arena (bytes), a power of 2 */
+#endif
+#ifndef MM_SL_SHIFT
+#define MM_SL_SHIFT 3 /* log2 of the second level size classes per power of two, 1 to 5 */
+#endif
+#ifndef MM_PLACEMENT
+#define MM_PLACEMENT MM_GOOD_FIT /* placement policy until mm_set_placement changes it */
+#endif
+
+/* Checking and code generation */
+#ifndef MM_CHECK
+#define MM_CHECK 0 /* 1 checks each pointer given to mm_free and mm_realloc, 2 also the whole heap after every call */
+#endif
+#ifndef MM_CHECK_EVERY
+#define MM_CHECK_EVERY 0 /* check the next MM_CHECK_BLOCKS blocks of the heap every this many mallocs, 0 never */
+#endif
+#ifndef MM_CHECK_BLOCKS
+#define MM_CHECK_BLOCKS 16 /* blocks each of those checks looks at */
+#endif
+#ifndef MM_INLINE
+#define MM_INLINE 0 /* force the helpers of the malloc and free paths inline */
+#endif
+
+#if MM_TCACHE && !MM_THREADS
+#error "MM_TCACHE requires MM_THREADS"
+#endif
+#if MM_ARENAS > 1 && !MM_THREADS
+#error "MM_ARENAS > 1 requires MM_THREADS"
+#endif
+#if MM_ARENAS > 255
+#error "MM_ARENAS must be at most 255"
+#endif
+
+#if MM_ALIGNMENT != 8 && MM_ALIGNMENT != 16
+#error "MM_ALIGNMENT must be 8 or 16"
+#endif
+#if MM_MMAP_THRESHOLD >= (1 << 30) - 8
+#error "MM_MMAP_THRESHOLD must be below the largest block"
+#endif
+#if MM_TRIM_THRESHOLD && MM_TRIM_THRESHOLD <= MM_TRIM_PAD
+#error "MM_TRIM_THRESHOLD must be above MM_TRIM_PAD"
+#endif
+#if MM_COMPACT_LINKS && MAX_HEAP > 0xffffffff
+#error "MM_COMPACT_LINKS requires MAX_HEAP below 4 GB"
+#endif
+#if MM_TREE_THRESHOLD && (MM_TREE_THRESHOLD & (MM_TREE_THRESHOLD - 1) || MM_TREE_THRESHOLD < 1 << 10)
+#error "MM_TREE_THRESHOLD must be a power of 2 of at least 1024"
+#endif
+#if MM_CHUNKSIZE & (MM_CHUNKSIZE - 1) || MM_CHUNKSIZE < 1 << 12 || (MM_ARENAS > 1 && MM_CHUNKSIZE != 1 << 16)
+#error "MM_CHUNKSIZE must be a power of 2 of at least 4096, and 1 << 16 (an arena granule) with MM_ARENAS > 1"
+#endif
+#if MM_SL_SHIFT < 1 || MM_SL_SHIFT > 5
+#error "MM_SL_SHIFT must be 1 to 5"
+#endif
+#if MM_CHECK < 0 || MM_CHECK > 2
+#error "MM_CHECK must be 0, 1 or 2"
+#endif
+#if MM_CHECK_EVERY < 0 || MM_CHECK_BLOCKS < 1
+#error "MM_CHECK_EVERY must be at least 0 and MM_CHECK_BLOCKS at least 1"
+#endif
@@ -0,0 +1,147 @@
+/*
+ * mmpreload.c - Run mm.c as the malloc of an unmodified program
+ *
+ * Built as libmm.so, together with mm.c in its thread safe build and
+ * memlib.c backed by reserved address space (MEM_MMAP), it replaces the
+ * allocation functions of the C library:
+ *
+ *     unix> LD_PRELOAD=./libmm.so ./app
+ *
+ * The heap is set up on the first call of any of them. Payloads are 16
+ * byte aligned, as malloc must give on x86_64, and larger alignments
+ * come from mm_memalign. Requests of size 0 get the smallest block, so
+ * every successful call returns a pointer that can be freed, and failed
+ * ones set errno to ENOMEM like the C library's.
+ *
+ * The heap is at most MAX_HEAP bytes (see config.h), a block at most
+ * about 1 GB; larger requests fail.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "memlib.h"
+#include "mm.h"
+
+static pthread_once_t heap_once = PTHREAD_ONCE_INIT;
+
+/*
+ * init_heap - Reserve the heap and lay out its first segment
+ */
+static void init_heap(void) {
+    mem_init();
+    mm_init();
+}
+
+/*
+ * owned - Did mm.c allocate ptr, in the heap or in a mapped region? The dynamic loader
+ allocates with a malloc of its own before libmm.so is relocated, and the C library may
+ free those blocks later.
+ */
+static int owned(void *ptr) {
+    pthread_once(&heap_once, init_heap);
+    return mm_owns(ptr);
+}
+
+/*
+ * allocated - Return ptr, setting errno when the allocation failed
+ */
+static void *allocated(void *ptr) {
+    if (ptr == NULL)
+        errno = ENOMEM;
+    return ptr;
+}
+
+void *malloc(size_t size) {
+    pthread_once(&heap_once, init_heap);
+    return allocated(mm_malloc(size > 0 ? size : 1));
+}
+
+void free(void *ptr) {
+    /* blocks of the loader's malloc are left alone */
+    if (ptr != NULL && owned(ptr))
+        mm_free(ptr);
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    /* not malloc, which the compiler would turn back into calloc together with the memset */
+    pthread_once(&heap_once, init_heap);
+    void *ptr = allocated(mm_malloc(bytes > 0 ? bytes : 1));
+    if (ptr != NULL)
+        memset(ptr, 0, bytes);
+    return ptr;
+}
+
+void *realloc(void *ptr, size_t size) {
+    if (ptr == NULL)
+        return malloc(size);
+    if (size == 0) {
+        free(ptr);
+        return NULL;
+    }
+    /* the size of a block of the loader's malloc is unknown, so it cannot be moved */
+    if (!owned(ptr)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return allocated(mm_realloc(ptr, size));
+}
+
+void *reallocarray(void *ptr, size_t nmemb, size_t size) {
+    size_t bytes;
+    if (__builtin_mul_overflow(nmemb, size, &bytes)) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return realloc(ptr, bytes);
+}
+
+void *memalign(size_t alignment, size_t size) {
+    if (alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    pthread_once(&heap_once, init_heap);
+    return allocated(mm_memalign(alignment, size > 0 ? size : 1));
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if (alignment == 0 || alignment % sizeof(void *) || (alignment & (alignment - 1)))
+        return EINVAL;
+    pthread_once(&heap_once, init_heap);
+    void *ptr = mm_memalign(alignment, size > 0 ? size : 1);
+    if (ptr == NULL)
+        return ENOMEM;
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return memalign(getpagesize(), size);
+}
+
+void *pvalloc(size_t size) {
+    size_t page = getpagesize();
+    if (size > SIZE_MAX - page) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    return memalign(page, (size + page - 1) & ~(page - 1));
+}
+
+size_t malloc_usable_size(void *ptr) {
+    return (ptr != NULL && owned(ptr)) ? mm_usable_size(ptr) : 0;
+}
@@ -0,0 +1,599 @@
+/*
+ * mmrecord.c - Record the allocations of a running program as a trace
+ *
+ * Built as libmmrecord.so and preloaded into an unmodified program, it
+ * records every malloc, calloc, realloc and free the program makes into
+ * a trace that the driver replays:
+ *
+ *     unix> MMRECORD_FILE=app.rep LD_PRELOAD=./libmmrecord.so ./app
+ *     unix> ./mdriver -f app.rep
+ *
+ * MMRECORD_FILE names the trace, mmrecord.rep by default. A name
+ * ending in .bin gives a binary trace (see trace.h) and a %p in the
+ * name is replaced by the process id.
+ *
+ * Each call appends an event to a ring buffer owned by its thread, with
+ * no lock taken: only the thread writes the head of its ring and only
+ * the flusher thread writes the tail. Events are numbered from a global
+ * counter, so the flusher, which wakes up every FLUSH_INTERVAL, can put
+ * the events of all threads back in the order they happened. It maps
+ * the payload addresses to the request ids of the trace and writes the
+ * requests out. A thread whose ring is full waits for the flusher
+ * rather than lose events.
+ *
+ * A free takes its number before the block is freed and a malloc
+ * after the block is allocated, so a block reused by another thread
+ * is always freed first in the trace. A realloc can only be numbered
+ * on one side of the call; if another thread gets the old block
+ * before the realloc is numbered, the flusher turns the request it
+ * cannot place into a malloc. Frees of blocks it never saw allocated,
+ * such as those of aligned allocations, which are not recorded, are
+ * left out. Blocks still allocated at exit are left allocated.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+#define RING_SIZE 65536               /* events in the ring of a thread, a power of 2 */
+#define FLUSH_INTERVAL 10000000       /* ns between two flushes */
+#define BOOT_HEAP_SIZE 65536          /* heap for the allocations dlsym makes before malloc is known */
+#define PTRMAP_MIN 4096               /* slots of an empty pointer map, a power of 2 */
+#define OUT_BUFSIZE 65536             /* size of the output buffer */
+#define HDR_FORMAT "%11d\n"           /* fixed width, so the header can be rewritten at exit */
+
+/* Home slot of payload p in a pointer map */
+#define PTRMAP_HASH(p, mask) ((unsigned)(((uintptr_t)(p) >> 4) * 2654435761u) & (mask))
+
+/* One recorded call */
+typedef struct {
+    uint64_t seq; /* number of the call in the order of all calls */
+    int type;     /* ALLOC, REALLOC or FREE */
+    void *p;      /* allocated or freed payload, or the old payload of a realloc */
+    void *newp;   /* new payload of a realloc */
+    size_t size;  /* requested size */
+} event_t;
+
+/* Ring buffer of the events of one thread */
+typedef struct ring {
+    uint64_t head;     /* number of events written, only written by the owner */
+    uint64_t tail;     /* number of events taken, only written by the flusher */
+    int owned;         /* is a thread writing to the ring? */
+    struct ring *next; /* next ring in the list of all rings */
+    event_t events[RING_SIZE];
+} ring_t;
+
+/* Live block of the recorded program, kept in the pointer map under its payload */
+typedef struct {
+    void *p;     /* payload, NULL for an empty slot */
+    int id;      /* request id of the block in the trace */
+    size_t size; /* payload size */
+} ptrslot_t;
+
+/* the functions of the allocator the program was linked with */
+static void *(*real_malloc)(size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_realloc)(void *, size_t);
+static void (*real_free)(void *);
+
+/* Serves the allocations of dlsym while the real functions are looked up */
+static char boot_heap[BOOT_HEAP_SIZE];
+static size_t boot_used;
+
+static int recording;          /* are calls recorded? */
+static pid_t recorder_pid;     /* the process being recorded, not a child forked from it */
+static uint64_t next_seq;      /* number of the next call */
+static ring_t *rings;          /* list of all rings */
+static pthread_key_t ring_key; /* only used to give a ring up when its thread exits */
+static pthread_t flusher;
+static int stop_flusher;
+
+/* Calls made by the recorder itself, or while the recorder is busy, are not recorded */
+static __thread int busy __attribute__((tls_model("initial-exec")));
+static __thread ring_t *thread_ring __attribute__((tls_model("initial-exec")));
+
+/* State of the flusher thread */
+static event_t *pending;           /* events taken from the rings, not yet written */
+static size_t num_pending, max_pending;
+static uint64_t written_seq;       /* number of the next event to write */
+static ptrslot_t *ptrmap;          /* live blocks by payload */
+static unsigned ptrmap_mask, ptrmap_count;
+static int out_fd = -1, out_binary;
+static char out_buf[OUT_BUFSIZE];
+static size_t out_len;
+static int num_ids, num_ops;
+static size_t live_bytes, peak_bytes;
+
+static void resolve(void);
+static void record(int type, void *p, void *newp, size_t size, uint64_t seq);
+static ring_t *claim_ring(void);
+static void release_ring(void *ring);
+static void *flush_loop(void *arg);
+static void flush(int final);
+static int seq_order(const void *a, const void *b);
+static void write_event(event_t *e);
+static void write_op(int type, int id, size_t size);
+static void out_write(const void *data, size_t len);
+static void out_flush(void);
+static void write_header(void);
+static ptrslot_t *ptrmap_find(void *p);
+static void ptrmap_add(void *p, int id, size_t size);
+static void ptrmap_remove(ptrslot_t *slot);
+static void stop_in_child(void);
+
+/*
+ * resolve - Look up the allocator functions that the recorded ones forward to
+ */
+static void resolve(void) {
+    busy++;
+    real_malloc = dlsym(RTLD_NEXT, "malloc");
+    real_calloc = dlsym(RTLD_NEXT, "calloc");
+    real_realloc = dlsym(RTLD_NEXT, "realloc");
+    real_free = dlsym(RTLD_NEXT, "free");
+    busy--;
+}
+
+/*
+ * boot_alloc - Take size bytes from the boot heap, whose memory is never freed
+ */
+static void *boot_alloc(size_t size) {
+    void *p = boot_heap + boot_used;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_HEAP_SIZE)
+        return NULL;
+    boot_used += size;
+    return p;
+}
+
+#define IN_BOOT_HEAP(p) ((char *)(p) >= boot_heap && (char *)(p) < boot_heap + BOOT_HEAP_SIZE)
+
+/*
+ * Before the recorder is set up, and while dlsym looks the real
+ * functions up, the calls are passed on or served from the boot heap.
+ */
+void *malloc(size_t size) {
+    uint64_t seq;
+    void *p;
+
+    if (real_malloc == NULL) {
+        if (busy)
+            return boot_alloc(size);
+        resolve();
+    }
+    if (!recording || busy)
+        return real_malloc(size);
+    /* a call that is not recorded must not take a number, or the flusher would wait for it */
+    if ((p = real_malloc(size)) != NULL) {
+        seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+        record(ALLOC, p, NULL, size, seq);
+    }
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size) {
+    uint64_t seq;
+    void *p;
+
+    if (real_calloc == NULL) {
+        if (busy)
+            return boot_alloc(nmemb * size); /* the boot heap is zero already */
+        resolve();
+    }
+    if (!recording || busy)
+        return real_calloc(nmemb, size);
+    if ((p = real_calloc(nmemb, size)) != NULL) {
+        seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+        record(ALLOC, p, NULL, nmemb * size, seq);
+    }
+    return p;
+}
+
+void *realloc(void *ptr, size_t size) {
+    uint64_t seq;
+    size_t left;
+    void *p;
+
+    if (IN_BOOT_HEAP(ptr)) {
+        /* a boot heap block moves to the real heap, copying at most what lies up to the end of the boot heap */
+        left = boot_heap + BOOT_HEAP_SIZE - (char *)ptr;
+        if ((p = malloc(size)) != NULL)
+            memcpy(p, ptr, size < left ? size : left);
+        return p;
+    }
+    if (real_realloc == NULL)
+        resolve();
+    if (!recording || busy)
+        return real_realloc(ptr, size);
+    p = real_realloc(ptr, size);
+    seq = __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+    record(REALLOC, ptr, p, size, seq);
+    return p;
+}
+
+void free(void *ptr) {
+    if (ptr == NULL || IN_BOOT_HEAP(ptr))
+        return;
+    if (real_free == NULL) {
+        if (busy)
+            return; /* freed while dlsym looks free up, leak it */
+        resolve();
+    }
+    if (recording && !busy)
+        record(FREE, ptr, NULL, 0, __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED));
+    real_free(ptr);
+}
+
+/*
+ * record - Append an event to the ring of the calling thread
+ */
+static void record(int type, void *p, void *newp, size_t size, uint64_t seq) {
+    ring_t *ring = thread_ring;
+    event_t *e;
+
+    busy++;
+    if (ring == NULL)
+        ring = claim_ring();
+    /* wait for the flusher when the ring is full */
+    while (ring->head - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE)
+        sched_yield();
+    e = &ring->events[ring->head & (RING_SIZE - 1)];
+    e->seq = seq;
+    e->type = type;
+    e->p = p;
+    e->newp = newp;
+    e->size = size;
+    __atomic_store_n(&ring->head, ring->head + 1, __ATOMIC_RELEASE);
+    busy--;
+}
+
+/*
+ * claim_ring - Give the calling thread a ring, reusing the drained ring of
+ *     a thread that exited or mapping a new one
+ */
+static ring_t *claim_ring(void) {
+    ring_t *ring;
+    int unowned;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        unowned = 0;
+        if (__atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == ring->head &&
+            __atomic_compare_exchange_n(&ring->owned, &unowned, 1, 0, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+            break;
+    }
+    if (ring == NULL) {
+        ring = mmap(NULL, sizeof(ring_t), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (ring == MAP_FAILED) {
+            fprintf(stderr, "mmrecord: could not map a ring\n");
+            abort();
+        }
+        ring->owned = 1;
+        ring->next = __atomic_load_n(&rings, __ATOMIC_RELAXED);
+        while (!__atomic_compare_exchange_n(&rings, &ring->next, ring, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED))
+            ;
+    }
+    thread_ring = ring;
+    pthread_setspecific(ring_key, ring);
+    return ring;
+}
+
+/*
+ * release_ring - Give up the ring of an exiting thread, once the flusher drained it another thread can take it
+ */
+static void release_ring(void *ring) {
+    thread_ring = NULL;
+    __atomic_store_n(&((ring_t *)ring)->owned, 0, __ATOMIC_RELEASE);
+}
+
+/*
+ * start_recording - Open the trace and start the flusher, before main runs
+ */
+__attribute__((constructor)) static void start_recording(void) {
+    char path[PATH_MAX];
+    char *name = getenv("MMRECORD_FILE");
+    char *pid;
+    size_t len;
+
+    if (real_malloc == NULL)
+        resolve();
+    busy++;
+    if (name == NULL)
+        name = "mmrecord.rep";
+    if ((pid = strstr(name, "%p")) != NULL)
+        snprintf(path, sizeof(path), "%.*s%d%s", (int)(pid - name), name, (int)getpid(), pid + 2);
+    else
+        snprintf(path, sizeof(path), "%s", name);
+    len = strlen(path);
+    out_binary = len > 4 && strcmp(path + len - 4, ".bin") == 0;
+    if ((out_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0) {
+        perror(path);
+        busy--;
+        return;
+    }
+    write_header();
+    ptrmap_mask = PTRMAP_MIN - 1;
+    ptrmap = real_calloc(PTRMAP_MIN, sizeof(ptrslot_t));
+    pthread_key_create(&ring_key, release_ring);
+    pthread_atfork(NULL, NULL, stop_in_child);
+    recorder_pid = getpid();
+    if (ptrmap == NULL || pthread_create(&flusher, NULL, flush_loop, NULL) != 0) {
+        fprintf(stderr, "mmrecord: could not start recording\n");
+        busy--;
+        return;
+    }
+    recording = 1;
+    busy--;
+}
+
+/*
+ * stop_recording - Write out what is left and the final header when the program exits
+ */
+__attribute__((destructor)) static void stop_recording(void) {
+    if (!recording || getpid() != recorder_pid)
+        return;
+    busy++;
+    recording = 0;
+    __atomic_store_n(&stop_flusher, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+    out_flush();
+    write_header();
+    close(out_fd);
+    busy--;
+}
+
+/*
+ * stop_in_child - A forked child has no flusher, so it does not record
+ */
+static void stop_in_child(void) {
+    recording = 0;
+}
+
+/*
+ * flush_loop - Body of the flusher thread
+ */
+static void *flush_loop(void *arg) {
+    struct timespec interval = {0, FLUSH_INTERVAL};
+
+    busy = 1;
+    while (!__atomic_load_n(&stop_flusher, __ATOMIC_ACQUIRE)) {
+        nanosleep(&interval, NULL);
+        flush(0);
+    }
+    flush(1);
+    return NULL;
+}
+
+/*
+ * flush - Take the events out of all rings and write them in order
+ *     An event is written only once all events numbered before it
+ *     are written, since a thread may have numbered a call and not
+ *     yet put it in its ring. The final flush writes everything.
+ */
+static void flush(int final) {
+    ring_t *ring;
+    uint64_t tail, head;
+    size_t i;
+
+    for (ring = __atomic_load_n(&rings, __ATOMIC_ACQUIRE); ring != NULL; ring = ring->next) {
+        tail = ring->tail;
+        head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+        if (num_pending + (head - tail) > max_pending) {
+            max_pending = 2 * (num_pending + (head - tail));
+            if ((pending = real_realloc(pending, max_pending * sizeof(event_t))) == NULL) {
+                fprintf(stderr, "mmrecord: out of memory\n");
+                abort();
+            }
+        }
+        for (; tail != head; tail++)
+            pending[num_pending++] = ring->events[tail & (RING_SIZE - 1)];
+        __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    }
+    qsort(pending, num_pending, sizeof(event_t), seq_order);
+    for (i = 0; i < num_pending && (final || pending[i].seq == written_seq); i++) {
+        write_event(&pending[i]);
+        written_seq = pending[i].seq + 1;
+    }
+    num_pending -= i;
+    memmove(pending, pending + i, num_pending * sizeof(event_t));
+    out_flush();
+}
+
+/*
+ * seq_order - Order events by their numbers, for qsort
+ */
+static int seq_order(const void *a, const void *b) {
+    uint64_t x = ((const event_t *)a)->seq, y = ((const event_t *)b)->seq;
+    return (x > y) - (x < y);
+}
+
+/*
+ * write_event - Turn an event into the request of the trace it stands for
+ * Case 1: a malloc, which gets a new id. A block of that address still
+ *    live in the trace was freed unseen, so it is freed first
+ * Case 2: a free of a live block
+ * Case 3: a realloc of a live block, which keeps its id
+ * Case 4: a realloc of an unknown block, recorded as a malloc
+ * Sizes that do not fit a trace request turn the request into a free.
+ */
+static void write_event(event_t *e) {
+    ptrslot_t *slot = ptrmap_find(e->p);
+    int id;
+
+    if (e->type == ALLOC || (e->type == REALLOC && slot == NULL)) { /* Case 1 and 4 */
+        void *p = (e->type == ALLOC) ? e->p : e->newp;
+        if (p == NULL || e->size == 0 || e->size > INT_MAX)
+            return;
+        if ((slot = ptrmap_find(p)) != NULL) {
+            write_op(FREE, slot->id, 0);
+            live_bytes -= slot->size;
+            ptrmap_remove(slot);
+        }
+        write_op(ALLOC, num_ids, e->size);
+        ptrmap_add(p, num_ids++, e->size);
+        live_bytes += e->size;
+    } else if (slot == NULL) {
+        return;
+    } else if (e->type == FREE || (e->newp == NULL && e->size == 0) || e->size > INT_MAX) { /* Case 2 */
+        write_op(FREE, slot->id, 0);
+        live_bytes -= slot->size;
+        ptrmap_remove(slot);
+    } else if (e->newp != NULL) { /* Case 3 */
+        id = slot->id;
+        live_bytes += e->size - slot->size;
+        ptrmap_remove(slot);
+        if ((slot = ptrmap_find(e->newp)) != NULL) {
+            write_op(FREE, slot->id, 0);
+            live_bytes -= slot->size;
+            ptrmap_remove(slot);
+        }
+        write_op(REALLOC, id, e->size);
+        ptrmap_add(e->newp, id, e->size);
+    }
+    peak_bytes = live_bytes > peak_bytes ? live_bytes : peak_bytes;
+}
+
+/*
+ * write_op - Append one request to the trace
+ */
+static void write_op(int type, int id, size_t size) {
+    traceop_t op;
+    char line[32];
+
+    num_ops++;
+    if (out_binary) {
+        op.type = type;
+        op.index = id;
+        op.size = size;
+        op.batch = 0;
+        out_write(&op, sizeof(op));
+    } else if (type == FREE) {
+        out_write(line, snprintf(line, sizeof(line), "f %d\n", id));
+    } else {
+        out_write(line, snprintf(line, sizeof(line), "%c %d %d\n", type == ALLOC ? 'a' : 'r', id, (int)size));
+    }
+}
+
+/*
+ * out_write - Buffer len bytes of the trace
+ */
+static void out_write(const void *data, size_t len) {
+    if (out_len + len > OUT_BUFSIZE)
+        out_flush();
+    memcpy(out_buf + out_len, data, len);
+    out_len += len;
+}
+
+/*
+ * out_flush - Write the buffered bytes of the trace to its file
+ */
+static void out_flush(void) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < out_len) {
+        if ((n = write(out_fd, out_buf + done, out_len - done)) < 0) {
+            perror("mmrecord: write");
+            break;
+        }
+        done += n;
+    }
+    out_len = 0;
+}
+
+/*
+ * write_header - Write the trace header at the start of the trace file
+ *     The header has the same length whatever its numbers, so it is
+ *     written once when the trace is opened and again at exit.
+ */
+static void write_header(void) {
+    trace_hdr_t hdr;
+    char text[4 * 12 + 1];
+    int len;
+    int peak = peak_bytes > INT_MAX ? INT_MAX : peak_bytes;
+
+    if (out_binary) {
+        memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+        hdr.sugg_heapsize = peak;
+        hdr.num_ids = num_ids;
+        hdr.num_ops = num_ops;
+        hdr.weight = 1;
+        pwrite(out_fd, &hdr, sizeof(hdr), 0);
+        if (lseek(out_fd, 0, SEEK_CUR) < (off_t)sizeof(hdr))
+            lseek(out_fd, sizeof(hdr), SEEK_SET);
+    } else {
+        len = snprintf(text, sizeof(text), HDR_FORMAT HDR_FORMAT HDR_FORMAT HDR_FORMAT,
+                       peak, num_ids, num_ops, 1);
+        pwrite(out_fd, text, len, 0);
+        if (lseek(out_fd, 0, SEEK_CUR) < len)
+            lseek(out_fd, len, SEEK_SET);
+    }
+}
+
+/*
+ * ptrmap_find - Return the slot of the live block with payload p, or NULL
+ */
+static ptrslot_t *ptrmap_find(void *p) {
+    unsigned i;
+
+    for (i = PTRMAP_HASH(p, ptrmap_mask); ptrmap[i].p != NULL; i = (i + 1) & ptrmap_mask)
+        if (ptrmap[i].p == p)
+            return &ptrmap[i];
+    return NULL;
+}
+
+/*
+ * ptrmap_add - Add a live block, doubling the map first when it would be more than 3/4 full
+ */
+static void ptrmap_add(void *p, int id, size_t size) {
+    ptrslot_t *old = ptrmap;
+    unsigned i, n = ptrmap_mask + 1;
+
+    if ((ptrmap_count + 1) * 4 > n * 3) {
+        if ((ptrmap = real_calloc(2 * n, sizeof(ptrslot_t))) == NULL) {
+            fprintf(stderr, "mmrecord: out of memory\n");
+            abort();
+        }
+        ptrmap_mask = 2 * n - 1;
+        ptrmap_count = 0;
+        for (i = 0; i < n; i++)
+            if (old[i].p != NULL)
+                ptrmap_add(old[i].p, old[i].id, old[i].size);
+        real_free(old);
+    }
+    for (i = PTRMAP_HASH(p, ptrmap_mask); ptrmap[i].p != NULL; i = (i + 1) & ptrmap_mask)
+        ;
+    ptrmap[i].p = p;
+    ptrmap[i].id = id;
+    ptrmap[i].size = size;
+    ptrmap_count++;
+}
+
+/*
+ * ptrmap_remove - Remove the block in slot, shifting the slots after it back
+ */
+static void ptrmap_remove(ptrslot_t *slot) {
+    unsigned hole = slot - ptrmap;
+    unsigned i, home;
+
+    for (i = (hole + 1) & ptrmap_mask; ptrmap[i].p != NULL; i = (i + 1) & ptrmap_mask) {
+        /* the slot at i may fill the hole unless its home lies after the hole, up to i */
+        home = PTRMAP_HASH(ptrmap[i].p, ptrmap_mask);
+        if (((i - home) & ptrmap_mask) >= ((i - hole) & ptrmap_mask)) {
+            ptrmap[hole] = ptrmap[i];
+            hole = i;
+        }
+    }
+    ptrmap[hole].p = NULL;
+    ptrmap_count--;
+}
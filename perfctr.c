@@ -0,0 +1,105 @@
+/*
+ * perfctr.c - Count hardware events of the processor with perf_event_open
+ *
+ * Each event gets a counter of its own, counting in user mode only so
+ * the counters open under the default perf_event_paranoid setting. The
+ * kernel may have fewer hardware counters than events and then time
+ * shares them; a count is scaled up by the time its counter was
+ * enabled over the time it actually ran. Events the processor or a
+ * virtual machine does not offer are left out; page faults, counted by
+ * the kernel, are there on every machine.
+ */
+#define _GNU_SOURCE
+#include <linux/perf_event.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+/* a cache event: the cache, the operation and the result */
+#define CACHE_EVENT(cache, op, result) \
+    ((cache) | ((op) << 8) | ((result) << 16))
+
+char *perf_event_names[PERF_EVENTS] = {"instructions", "cycles", "branch_misses",
+                                       "l1d_misses", "llc_misses", "dtlb_misses", "page_faults"};
+
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_EVENTS] = {
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_L1D, PERF_COUNT_HW_CACHE_OP_READ,
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {PERF_TYPE_HW_CACHE, CACHE_EVENT(PERF_COUNT_HW_CACHE_DTLB, PERF_COUNT_HW_CACHE_OP_READ,
+                                     PERF_COUNT_HW_CACHE_RESULT_MISS)},
+    {PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS},
+};
+
+static int fds[PERF_EVENTS] = {-1, -1, -1, -1, -1, -1, -1};
+
+/*
+ * perf_open - Open a counter of each event for this thread, return how many opened
+ */
+int perf_open(void) {
+    struct perf_event_attr attr;
+    int i, opened = 0;
+
+    for (i = 0; i < PERF_EVENTS; i++) {
+        if (fds[i] >= 0) {
+            opened++;
+            continue;
+        }
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fds[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fds[i] >= 0)
+            opened++;
+    }
+    return opened;
+}
+
+/*
+ * perf_start - Zero the counters and start them
+ */
+void perf_start(void) {
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+        if (fds[i] >= 0) {
+            ioctl(fds[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+/*
+ * perf_stop - Stop the counters and get their counts, -1 for an event not counted
+ */
+void perf_stop(double counts[PERF_EVENTS]) {
+    uint64_t value[3]; /* count, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_EVENTS; i++)
+        if (fds[i] >= 0)
+            ioctl(fds[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PERF_EVENTS; i++) {
+        counts[i] = -1;
+        if (fds[i] < 0 || read(fds[i], value, sizeof(value)) != sizeof(value))
+            continue;
+        if (value[2] == 0)
+            counts[i] = 0;
+        else
+            counts[i] = (double)value[0] * value[1] / value[2];
+    }
+}
@@ -0,0 +1,18 @@
+/*
+ * perfctr.h - Hardware event counters of the processor, from perf_event_open
+ */
+
+/* The events counted, in the order of the counts */
+#define PERF_EVENTS 7
+enum { PERF_INSTRUCTIONS, PERF_CYCLES, PERF_BRANCH_MISSES,
+       PERF_L1D_MISSES, PERF_LLC_MISSES, PERF_DTLB_MISSES, PERF_PAGE_FAULTS };
+extern char *perf_event_names[PERF_EVENTS];
+
+/* Open a counter of each event for this thread, return how many opened */
+int perf_open(void);
+
+/* Zero the counters and start them */
+void perf_start(void);
+
+/* Stop the counters and get their counts, -1 for an event that is not counted */
+void perf_stop(double counts[PERF_EVENTS]);
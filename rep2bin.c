@@ -0,0 +1,28 @@
+/*
+ * rep2bin.c - Convert a text trace (.rep) into a binary trace
+ *
+ * The driver maps binary traces instead of parsing them, which matters
+ * for traces with millions of requests. Binary traces are in native
+ * byte order, so convert them on the kind of machine that replays them.
+ *
+ *     unix> ./rep2bin traces/binary-bal.rep binary-bal.bin
+ *     unix> ./mdriver -f binary-bal.bin
+ */
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+int main(int argc, char **argv) {
+    trace_t *trace;
+
+    if (argc != 3) {
+        fprintf(stderr, "Usage: rep2bin <tracefile> <binary tracefile>\n");
+        exit(1);
+    }
+    trace = load_trace(argv[1]);
+    write_trace_bin(trace, argv[2]);
+    printf("%s: %d requests, %d ids\n", argv[2], trace->num_ops, trace->num_ids);
+    free_trace(trace);
+    return 0;
+}
@@ -0,0 +1,488 @@
+/*
+ * trace.c - Reading and writing the allocator traces used by the driver
+ *
+ * Text traces are read through a small buffered tokenizer, which only
+ * has to know about unsigned numbers and request letters. Binary traces
+ * are mapped into memory and their requests used in place.
+ *
+ * A trace stream reads the same files, or a pipe, through the same
+ * reader a window of requests at a time, so a trace never needs to be
+ * in memory as a whole.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+/* the request records of a binary trace are the in-memory records */
+_Static_assert(sizeof(traceop_t) == 16, "traceop_t is not packed as binary traces expect");
+
+/* Size of the text reader's buffer */
+#define TRACE_BUFSIZE 65536
+
+/* Buffered reader over a trace file */
+typedef struct reader {
+    int fd;
+    char *path;
+    char *pos; /* next unread byte in buf */
+    char *end; /* end of the bytes read into buf */
+    traceop_t batch; /* the requests of the batch of a text trace being read... */
+    unsigned batch_left; /* ... of which this many ids are still to be read */
+    char buf[TRACE_BUFSIZE];
+} reader_t;
+
+static void trace_error(char *msg, char *path);
+static void alloc_blocks(trace_t *trace, char *path);
+static reader_t *open_reader(char *path);
+static int is_binary(reader_t *r);
+static int peek_char(reader_t *r);
+static int next_char(reader_t *r);
+static unsigned next_uint(reader_t *r);
+static size_t read_bytes(reader_t *r, void *dst, size_t n);
+static int read_text_op(reader_t *r, traceop_t *op);
+static int bogus_op(traceop_t *ops, int n);
+static void read_text(reader_t *r, trace_t *trace);
+static void map_binary(reader_t *r, trace_t *trace);
+static void start_stream(tstream_t *s);
+
+/*
+ * trace_error - Report an error about trace file path and exit
+ */
+static void trace_error(char *msg, char *path) {
+    if (errno != 0)
+        printf("%s %s: %s\n", msg, path, strerror(errno));
+    else
+        printf("%s %s\n", msg, path);
+    exit(1);
+}
+
+/*
+ * open_reader - Open a reader over the file at path, "-" being the standard input
+ */
+static reader_t *open_reader(char *path) {
+    reader_t *r;
+
+    if ((r = (reader_t *)malloc(sizeof(reader_t))) == NULL)
+        trace_error("malloc failed in open_reader for", path);
+    if (strcmp(path, "-") == 0)
+        r->fd = STDIN_FILENO;
+    else if ((r->fd = open(path, O_RDONLY)) < 0)
+        trace_error("Could not open", path);
+    r->path = path;
+    r->pos = r->end = r->buf;
+    r->batch_left = 0;
+    return r;
+}
+
+/*
+ * is_binary - Tell whether the unread part of the file starts with a binary trace header
+ *     A pipe may deliver the header in pieces, so read until the whole
+ *     header is in the buffer or the file ends.
+ */
+static int is_binary(reader_t *r) {
+    ssize_t n;
+
+    memmove(r->buf, r->pos, r->end - r->pos);
+    r->end = r->buf + (r->end - r->pos);
+    r->pos = r->buf;
+    while (r->end - r->pos < (long)sizeof(trace_hdr_t)) {
+        if ((n = read(r->fd, r->end, r->buf + TRACE_BUFSIZE - r->end)) < 0)
+            trace_error("Could not read", r->path);
+        if (n == 0)
+            return 0;
+        r->end += n;
+    }
+    return memcmp(r->pos, TRACE_MAGIC, sizeof(TRACE_MAGIC) - 1) == 0;
+}
+
+/*
+ * peek_char - Return the next byte of the file without consuming it, EOF at its end
+ */
+static int peek_char(reader_t *r) {
+    if (r->pos == r->end) {
+        ssize_t n = read(r->fd, r->buf, TRACE_BUFSIZE);
+        if (n < 0)
+            trace_error("Could not read", r->path);
+        r->pos = r->buf;
+        r->end = r->buf + n;
+        if (n == 0)
+            return EOF;
+    }
+    return (unsigned char)*r->pos;
+}
+
+/*
+ * next_char - Skip white space and consume the byte after it, EOF at the end of the file
+ */
+static int next_char(reader_t *r) {
+    int c;
+
+    while ((c = peek_char(r)) == ' ' || c == '\n' || c == '\t' || c == '\r')
+        r->pos++;
+    if (c != EOF)
+        r->pos++;
+    return c;
+}
+
+/*
+ * next_uint - Skip white space and read an unsigned decimal number
+ */
+static unsigned next_uint(reader_t *r) {
+    int c = next_char(r);
+    unsigned n;
+
+    if (c < '0' || c > '9') {
+        errno = 0;
+        trace_error("Expected a number in tracefile", r->path);
+    }
+    n = c - '0';
+    while ((c = peek_char(r)) >= '0' && c <= '9') {
+        n = n * 10 + (c - '0');
+        r->pos++;
+    }
+    return n;
+}
+
+/*
+ * read_bytes - Copy the next n bytes of the file to dst, returns how many there were
+ */
+static size_t read_bytes(reader_t *r, void *dst, size_t n) {
+    size_t done = 0, k;
+
+    while (done < n && peek_char(r) != EOF) {
+        k = r->end - r->pos;
+        if (k > n - done)
+            k = n - done;
+        memcpy((char *)dst + done, r->pos, k);
+        r->pos += k;
+        done += k;
+    }
+    return done;
+}
+
+/*
+ * alloc_blocks - Allocate the arrays the driver keeps the blocks of a trace in
+ */
+static void alloc_blocks(trace_t *trace, char *path) {
+    /* We'll keep an array of pointers to the allocated blocks here... */
+    if ((trace->blocks =
+             (char **)malloc(trace->num_ids * sizeof(char *))) == NULL)
+        trace_error("malloc 3 failed in load_trace for", path);
+
+    /* ... along with the corresponding byte sizes of each block */
+    if ((trace->block_sizes =
+             (size_t *)malloc(trace->num_ids * sizeof(size_t))) == NULL)
+        trace_error("malloc 4 failed in load_trace for", path);
+}
+
+/*
+ * read_text_op - Parse the next request of a text trace into op, returns 0 at the end of the file
+ *     A batch line holds a request for each of its ids, which are
+ *     returned one by one.
+ */
+static int read_text_op(reader_t *r, traceop_t *op) {
+    int type;
+    unsigned n;
+
+    if (r->batch_left > 0) {
+        *op = r->batch;
+        op->index = next_uint(r);
+        r->batch_left--;
+        return 1;
+    }
+    if ((type = next_char(r)) == EOF)
+        return 0;
+    /* the request is named by the first letter of its word */
+    while (peek_char(r) != EOF && !strchr(" \n\t\r", *r->pos))
+        r->pos++;
+    op->batch = 0;
+    switch (type) {
+    case 'a':
+        op->type = ALLOC;
+        break;
+    case 'r':
+        op->type = REALLOC;
+        break;
+    case 'f':
+        op->type = FREE;
+        break;
+    case 'A':
+    case 'F':
+        if ((n = next_uint(r)) < 1 || n > TRACE_MAX_BATCH) {
+            printf("Bogus batch of %u requests in tracefile %s\n", n, r->path);
+            exit(1);
+        }
+        op->type = (type == 'A') ? ALLOC : FREE;
+        op->size = (type == 'A') ? next_uint(r) : 0;
+        op->index = next_uint(r);
+        r->batch = *op;
+        r->batch_left = n - 1;
+        op->batch = (n > 1) ? n : 0;
+        return 1;
+    default:
+        printf("Bogus type character (%c) in tracefile %s\n",
+               type, r->path);
+        exit(1);
+    }
+    op->index = next_uint(r);
+    op->size = (type != 'f') ? next_uint(r) : 0;
+    return 1;
+}
+
+/*
+ * bogus_op - Is ops[0], followed by n - 1 more requests, not a sound request of a binary trace?
+ *     A batch must be made of allocations of one size or of frees, which
+ *     is only checked as far as the n requests go.
+ */
+static int bogus_op(traceop_t *ops, int n) {
+    int i;
+
+    if ((ops->type != ALLOC && ops->type != FREE && ops->type != REALLOC) ||
+        ops->index < 0 || (ops->type != FREE && ops->size < 0))
+        return 1;
+    if (ops->batch == 0)
+        return 0;
+    if (ops->batch < 2 || ops->batch > TRACE_MAX_BATCH || ops->type == REALLOC)
+        return 1;
+    for (i = 1; i < ops->batch && i < n; i++) {
+        if (ops[i].type != ops->type || ops[i].batch != 0 ||
+            (ops->type == ALLOC && ops[i].size != ops->size))
+            return 1;
+    }
+    return 0;
+}
+
+/*
+ * read_text - Parse the header and the request lines of a text trace
+ */
+static void read_text(reader_t *r, trace_t *trace) {
+    traceop_t op;
+    unsigned max_index = 0;
+    unsigned op_index;
+
+    trace->sugg_heapsize = next_uint(r); /* not used */
+    trace->num_ids = next_uint(r);
+    trace->num_ops = next_uint(r);
+    trace->weight = next_uint(r); /* not used */
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops =
+             (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
+        trace_error("malloc 2 failed in load_trace for", r->path);
+
+    /* read every request line in the trace file */
+    op_index = 0;
+    while (read_text_op(r, &op)) {
+        if (op_index == trace->num_ops) {
+            errno = 0;
+            trace_error("More requests than the header says in tracefile", r->path);
+        }
+        trace->ops[op_index] = op;
+        if (op.type != FREE && (unsigned)op.index > max_index)
+            max_index = op.index;
+        op_index++;
+    }
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+}
+
+/*
+ * map_binary - Map a binary trace and check that its requests are sound
+ */
+static void map_binary(reader_t *r, trace_t *trace) {
+    struct stat st;
+    trace_hdr_t *hdr;
+    int i, max_index = 0;
+
+    if (fstat(r->fd, &st) < 0)
+        trace_error("Could not stat", r->path);
+    trace->map_size = st.st_size;
+    /* writable, for the driver to group requests into batches, which the file never sees */
+    trace->map = mmap(NULL, trace->map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE, r->fd, 0);
+    if (trace->map == MAP_FAILED)
+        trace_error("Could not map", r->path);
+    madvise(trace->map, trace->map_size, MADV_SEQUENTIAL);
+
+    hdr = trace->map;
+    trace->sugg_heapsize = hdr->sugg_heapsize;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->weight = hdr->weight;
+    trace->ops = (traceop_t *)(hdr + 1);
+    errno = 0;
+    if (trace->num_ops < 0 ||
+        trace->map_size != sizeof(trace_hdr_t) + (size_t)trace->num_ops * sizeof(traceop_t))
+        trace_error("Truncated binary tracefile", r->path);
+
+    for (i = 0; i < trace->num_ops; i++) {
+        traceop_t *op = &trace->ops[i];
+        if (bogus_op(op, trace->num_ops - i) || op->index >= trace->num_ids ||
+            i + op->batch > trace->num_ops)
+            trace_error("Bogus request in binary tracefile", r->path);
+        if (op->type != FREE && op->index > max_index)
+            max_index = op->index;
+    }
+    assert(max_index == trace->num_ids - 1);
+}
+
+/*
+ * load_trace - read the trace file at path and store it in memory
+ *     A file starting with TRACE_MAGIC is a binary trace, anything else
+ *     is parsed as a text trace.
+ */
+trace_t *load_trace(char *path) {
+    trace_t *trace;
+    reader_t *r;
+
+    /* Allocate the trace record and the reader */
+    if ((trace = (trace_t *)calloc(1, sizeof(trace_t))) == NULL)
+        trace_error("malloc 1 failed in load_trace for", path);
+    r = open_reader(path);
+
+    /* a binary trace is recognized by the magic number of its header */
+    if (is_binary(r))
+        map_binary(r, trace);
+    else
+        read_text(r, trace);
+    if (r->fd != STDIN_FILENO)
+        close(r->fd);
+    free(r);
+
+    alloc_blocks(trace, path);
+    return trace;
+}
+
+/*
+ * free_trace - Free the trace record and the three arrays it points
+ *              to, all of which were allocated in load_trace(), or
+ *              unmap the binary trace the requests lie in.
+ */
+void free_trace(trace_t *trace) {
+    if (trace->map != NULL)
+        munmap(trace->map, trace->map_size);
+    else
+        free(trace->ops); /* free the three arrays... */
+    free(trace->blocks);
+    free(trace->block_sizes);
+    free(trace); /* and the trace record itself... */
+}
+
+/*
+ * write_trace_bin - Write a trace to path as a binary trace
+ */
+void write_trace_bin(trace_t *trace, char *path) {
+    trace_hdr_t hdr;
+    FILE *f;
+
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.sugg_heapsize = trace->sugg_heapsize;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.weight = trace->weight;
+
+    if ((f = fopen(path, "wb")) == NULL)
+        trace_error("Could not create", path);
+    if (fwrite(&hdr, sizeof(hdr), 1, f) != 1 ||
+        fwrite(trace->ops, sizeof(traceop_t), trace->num_ops, f) != (size_t)trace->num_ops ||
+        fclose(f) != 0)
+        trace_error("Could not write", path);
+}
+
+/*
+ * start_stream - Read the header of the trace a stream is at the start of
+ */
+static void start_stream(tstream_t *s) {
+    reader_t *r = s->reader;
+    trace_hdr_t hdr;
+
+    s->binary = is_binary(r);
+    if (s->binary) {
+        read_bytes(r, &hdr, sizeof(hdr));
+        s->sugg_heapsize = hdr.sugg_heapsize;
+        s->num_ids = hdr.num_ids;
+        s->num_ops = hdr.num_ops;
+        s->weight = hdr.weight;
+    } else {
+        s->sugg_heapsize = next_uint(r);
+        s->num_ids = next_uint(r);
+        s->num_ops = next_uint(r);
+        s->weight = next_uint(r);
+    }
+    s->ops_read = 0;
+}
+
+/*
+ * open_trace_stream - Open the text or binary trace at path, "-" being the
+ *     standard input, to be read a window at a time
+ */
+tstream_t *open_trace_stream(char *path) {
+    tstream_t *s;
+
+    if ((s = (tstream_t *)malloc(sizeof(tstream_t))) == NULL)
+        trace_error("malloc failed in open_trace_stream for", path);
+    s->reader = open_reader(path);
+    start_stream(s);
+    return s;
+}
+
+/*
+ * read_trace_window - Read up to max requests of the stream into ops
+ *     Returns the number of requests read, 0 once the trace has ended.
+ *     The ids of the requests are not bounded by num_ids, nor is their
+ *     number checked against num_ops, since logs of running programs
+ *     often do not know them in advance.
+ */
+int read_trace_window(tstream_t *s, traceop_t *ops, int max) {
+    reader_t *r = s->reader;
+    size_t k;
+    int n;
+
+    for (n = 0; n < max; n++) {
+        if (!s->binary) {
+            if (!read_text_op(r, &ops[n]))
+                break;
+            continue;
+        }
+        if ((k = read_bytes(r, &ops[n], sizeof(traceop_t))) == 0)
+            break;
+        errno = 0;
+        if (k != sizeof(traceop_t))
+            trace_error("Truncated binary tracefile", r->path);
+        if (bogus_op(&ops[n], 1))
+            trace_error("Bogus request in binary tracefile", r->path);
+    }
+    s->ops_read += n;
+    return n;
+}
+
+/*
+ * rewind_trace_stream - Go back to the first request of the stream
+ *     Returns -1 when the input, like a pipe, cannot be read again.
+ */
+int rewind_trace_stream(tstream_t *s) {
+    reader_t *r = s->reader;
+
+    if (lseek(r->fd, 0, SEEK_SET) < 0)
+        return -1;
+    r->pos = r->end = r->buf;
+    r->batch_left = 0;
+    start_stream(s);
+    return 0;
+}
+
+/*
+ * close_trace_stream - Close the file of a stream and free it
+ */
+void close_trace_stream(tstream_t *s) {
+    if (s->reader->fd != STDIN_FILENO)
+        close(s->reader->fd);
+    free(s->reader);
+    free(s);
+}
@@ -0,0 +1,74 @@
+/*
+ * trace.h - Reading and writing the allocator traces used by the driver
+ *
+ * A trace is either a text .rep file or a binary trace. A binary trace
+ * is a trace_hdr_t followed by num_ops traceop_t records exactly as they
+ * are laid out in memory, so it is mapped and used without copying.
+ * Binary traces are in native byte order; convert them on the machine
+ * that replays them (see rep2bin.c).
+ *
+ * Traces too large for memory are read as a tstream_t instead, a
+ * window of requests at a time, from a file or a pipe.
+ */
+#include <stddef.h>
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    enum { ALLOC,
+           FREE,
+           REALLOC } type; /* type of request */
+    int index;             /* index for free() to use later */
+    int size;              /* byte size of alloc/realloc request */
+    int batch;             /* requests of the batch this one starts, 0 if it starts none */
+} traceop_t;
+
+/*
+ * A batch is made of the requests following each other that one call of
+ * mm_malloc_bulk or mm_free_bulk makes: allocations of one size, or
+ * frees. In a text trace the line "A n size id1 ... idn" allocates the
+ * ids and "F n id1 ... idn" frees them, each id counting as a request.
+ */
+#define TRACE_MAX_BATCH 1024 /* most requests in a batch */
+
+/* Holds the information for one trace file*/
+typedef struct {
+    int sugg_heapsize;   /* suggested heap size (unused) */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    void *map;           /* mapping of a binary trace file, which ops points into, or NULL */
+    size_t map_size;     /* length of that mapping */
+} trace_t;
+
+/* Header of a binary trace file */
+#define TRACE_MAGIC "MMTRACE2"
+typedef struct {
+    char magic[8];     /* TRACE_MAGIC, without its terminating 0 */
+    int sugg_heapsize; /* the four numbers of the text trace header */
+    int num_ids;
+    int num_ops;
+    int weight;
+} trace_hdr_t;
+
+trace_t *load_trace(char *path);
+void free_trace(trace_t *trace);
+void write_trace_bin(trace_t *trace, char *path);
+
+/* A trace read a window of requests at a time */
+typedef struct {
+    int sugg_heapsize;     /* the four numbers of the trace header */
+    int num_ids;
+    int num_ops;
+    int weight;
+    int binary;            /* is this a binary trace? */
+    long ops_read;         /* number of requests read since the start */
+    struct reader *reader; /* buffered reader over the file */
+} tstream_t;
+
+tstream_t *open_trace_stream(char *path);
+int read_trace_window(tstream_t *s, traceop_t *ops, int max);
+int rewind_trace_stream(tstream_t *s);
+void close_trace_stream(tstream_t *s);
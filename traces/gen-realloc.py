@@ -0,0 +1,144 @@
+#!/usr/bin/env python3
+#
+# gen-realloc.py - generate the realloc traces of the driver's test suite
+#
+# Each trace mixes mallocs, frees and reallocs the way a program that
+# grows its buffers does:
+#
+#   realloc-bal.rep          buffers that grow by small steps while
+#                            small objects get allocated between them
+#   realloc2-bal.rep         one buffer growing by large steps next to
+#                            short lived blocks of a few KB
+#   realloc-string-bal.rep   strings built by appends of a few bytes,
+#                            each append a realloc to the exact length
+#   realloc-vector-bal.rep   vectors doubling their capacity and
+#                            shrinking to fit when they are done
+#
+# Run it from the traces directory; the traces are written there.
+# The seed is fixed, so the same traces come out every time.
+#
+import random
+
+
+class Trace:
+    def __init__(self):
+        self.ops = []
+        self.live = {}   # id -> payload size
+        self.next_id = 0
+        self.total = 0
+        self.peak = 0
+
+    def malloc(self, size):
+        i = self.next_id
+        self.next_id += 1
+        self.ops.append("a %d %d" % (i, size))
+        self.live[i] = size
+        self._grew(size)
+        return i
+
+    def realloc(self, i, size):
+        self.ops.append("r %d %d" % (i, size))
+        self._grew(size - self.live[i])
+        self.live[i] = size
+
+    def free(self, i):
+        self.ops.append("f %d" % i)
+        self.total -= self.live.pop(i)
+
+    def _grew(self, delta):
+        self.total += delta
+        self.peak = max(self.peak, self.total)
+
+    def write(self, name):
+        for i in list(self.live):
+            self.free(i)
+        with open(name, "w") as f:
+            f.write("%d\n%d\n%d\n%d\n" % (self.peak, self.next_id, len(self.ops), 1))
+            f.write("\n".join(self.ops) + "\n")
+
+
+def buffer_growth(rng):
+    t = Trace()
+    buffers = {}  # id -> [size, goal]
+    small = []
+    for _ in range(2400):
+        if len(buffers) < 8:
+            buffers[t.malloc(512)] = [512, rng.randint(8, 64) << 10]
+        buf = rng.choice(list(buffers))
+        buffers[buf][0] += rng.choice([16, 64, 128, 512])
+        t.realloc(buf, buffers[buf][0])
+        small.append(t.malloc(rng.choice([16, 32, 128])))
+        if len(small) > 200:
+            t.free(small.pop(rng.randrange(len(small))))
+        if buffers[buf][0] >= buffers[buf][1]:
+            del buffers[buf]
+            t.free(buf)
+    return t
+
+
+def large_steps(rng):
+    t = Trace()
+    buf = t.malloc(4096)
+    size = 4096
+    blocks = []
+    for _ in range(2400):
+        size += rng.choice([512, 1024, 2048])
+        t.realloc(buf, size)
+        blocks.append(t.malloc(rng.choice([16, 4092, 5000])))
+        if len(blocks) > 8:
+            t.free(blocks.pop(0))
+        if size > 1 << 20:
+            t.realloc(buf, 4096)
+            size = 4096
+    return t
+
+
+def string_building(rng):
+    t = Trace()
+    building = {}  # id -> length
+    done = []
+    for _ in range(1500):
+        if len(building) < 50:
+            s = t.malloc(1)
+            building[s] = 0
+        s = rng.choice(list(building))
+        for _ in range(rng.randint(1, 8)):
+            building[s] += rng.randint(1, 40)
+            t.realloc(s, building[s] + 1)
+        if building[s] > rng.randint(200, 2000):
+            del building[s]
+            done.append(s)
+        if len(done) > 300:
+            t.free(done.pop(rng.randrange(len(done))))
+    return t
+
+
+def vector_doubling(rng):
+    t = Trace()
+    vectors = {}  # id -> [element size, capacity, length, goal]
+    for _ in range(6000):
+        if len(vectors) < 64:
+            width = rng.choice([8, 16, 24])
+            v = t.malloc(4 * width)
+            vectors[v] = [width, 4, 0, rng.choice([100, 500, 1000, 4000])]
+        v = rng.choice(list(vectors))
+        width, capacity, length, goal = vectors[v]
+        length += rng.randint(1, 64)
+        while length > capacity:
+            capacity *= 2
+            t.realloc(v, capacity * width)
+        vectors[v][1:3] = [capacity, length]
+        if length >= goal:
+            t.realloc(v, length * width)  # shrink to fit
+            del vectors[v]
+            if rng.random() < 0.5:
+                t.free(v)
+    return t
+
+
+if __name__ == "__main__":
+    for name, make in [("realloc-bal.rep", buffer_growth),
+                       ("realloc2-bal.rep", large_steps),
+                       ("realloc-string-bal.rep", string_building),
+                       ("realloc-vector-bal.rep", vector_doubling)]:
+        make(random.Random(name)).write(name)